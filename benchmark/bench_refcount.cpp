@@ -0,0 +1,60 @@
+/*
+ * Measures cost of copying and destroying a shared rune string from an
+ * increasing number of threads. Build the library once with
+ * PEELO_TEXT_ATOMIC_REFCOUNT enabled and once with it disabled to compare
+ * the two reference counting modes. Without atomic reference counting only
+ * the single threaded case is run, as sharing the string between threads
+ * would be a data race.
+ */
+#include <peelo/text/runestring.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+int main()
+{
+  static const int iterations = 10000000;
+  const peelo::runestring shared("shared configuration value");
+  const unsigned max_threads = PEELO_TEXT_ATOMIC_REFCOUNT
+    ? std::max(std::thread::hardware_concurrency(), 1u)
+    : 1;
+
+  std::cout << "atomic reference counting: "
+            << (PEELO_TEXT_ATOMIC_REFCOUNT ? "enabled" : "disabled")
+            << std::endl;
+  for (unsigned threads = 1; threads <= max_threads; threads *= 2)
+  {
+    std::vector<std::thread> workers;
+    const auto start = std::chrono::steady_clock::now();
+
+    for (unsigned i = 0; i < threads; ++i)
+    {
+      workers.push_back(std::thread([&shared]()
+      {
+        for (int j = 0; j < iterations; ++j)
+        {
+          peelo::runestring copy(shared);
+
+          // Keep the copy from being optimized away.
+          asm volatile("" : : "g"(&copy) : "memory");
+        }
+      }));
+    }
+    for (auto& worker : workers)
+    {
+      worker.join();
+    }
+
+    const auto elapsed = std::chrono::duration_cast<
+      std::chrono::nanoseconds
+    >(std::chrono::steady_clock::now() - start).count();
+
+    std::cout << threads << " threads: "
+              << static_cast<double>(elapsed) / iterations
+              << " ns per copy and destroy" << std::endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Measures time and number of memory allocations used by extracting words
+ * from text consisting of short tokens and normalizing their case, which is
+ * dominated by construction of short strings.
+ */
+#include <peelo/text/runestring.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <string>
+
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t size)
+{
+  void* p = std::malloc(size ? size : 1);
+
+  if (!p)
+  {
+    throw std::bad_alloc();
+  }
+  ++allocations;
+
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+int main()
+{
+  static const char* tokens[] = {
+    "if", "x", "==", "foo", "\xc3\xa4iti", "return", "{", "}", "let", "k\xc3\xb6"
+  };
+  static const int iterations = 200;
+  std::string input;
+  std::size_t words = 0;
+  std::size_t before;
+
+  for (int i = 0; i < 100000; ++i)
+  {
+    input += tokens[i % 10];
+    input += ' ';
+  }
+
+  const peelo::runestring text(input.c_str());
+  const auto start = std::chrono::steady_clock::now();
+
+  before = allocations;
+  for (int i = 0; i < iterations; ++i)
+  {
+    for (const auto& word : text.words())
+    {
+      words += word.to_lower().length() > 0;
+    }
+  }
+
+  const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now() - start
+  ).count();
+
+  std::cout << "words:                " << words << std::endl
+            << "allocations per word: "
+            << static_cast<double>(allocations - before) / words << std::endl
+            << "nanoseconds per word: "
+            << static_cast<double>(elapsed) / words << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEELO_TEXT_BATCH_LOADER_HPP_GUARD
+#define PEELO_TEXT_BATCH_LOADER_HPP_GUARD
+
+#include <peelo/text/runestring.hpp>
+#include <functional>
+#include <system_error>
+
+namespace peelo
+{
+  /**
+   * Loads large batches of UTF-8 encoded files into rune strings.
+   *
+   * On Linux the reads are submitted through io_uring, so that a single
+   * system call can submit and reap reads of several files. When io_uring is
+   * not available, either at build time or at run time, the files are read
+   * with <code>pread()</code> by a pool of threads instead.
+   *
+   * Each file is decoded as soon as its read completes. The number of reads
+   * in flight is bounded by the queue depth, and the total size of the read
+   * buffers held at the same time is bounded by the memory budget. A file
+   * larger than the memory budget is still loaded, but only when no other
+   * file is being read.
+   */
+  class batch_loader
+  {
+  public:
+    typedef std::size_t size_type;
+
+    /**
+     * Type of function which receives the loaded files. It's called with
+     * index of the path in the batch, decoded contents of the file and error
+     * code which is set when the file could not be read. Calls are never
+     * made concurrently, but they are made in completion order instead of
+     * the order of the paths.
+     */
+    typedef std::function<void(
+      size_type,
+      const runestring&,
+      const std::error_code&
+    )> callback_type;
+
+    /**
+     * Constructs new batch loader.
+     *
+     * \param queue_depth   Maximum number of files being read at the same
+     *                      time.
+     * \param memory_budget Maximum number of bytes held in read buffers at
+     *                      the same time.
+     */
+    explicit batch_loader(unsigned queue_depth = 64,
+                          size_type memory_budget = 64 * 1024 * 1024);
+
+    /**
+     * Returns the maximum number of files being read at the same time.
+     */
+    inline unsigned queue_depth() const
+    {
+      return m_queue_depth;
+    }
+
+    /**
+     * Returns the maximum number of bytes held in read buffers at the same
+     * time.
+     */
+    inline size_type memory_budget() const
+    {
+      return m_memory_budget;
+    }
+
+    /**
+     * Returns <code>true</code> if reads are submitted through io_uring, or
+     * <code>false</code> if the thread pool fallback is being used.
+     */
+    bool uses_io_uring() const;
+
+    /**
+     * Sets whether reads are submitted through io_uring when it's available.
+     * Disabling io_uring forces the thread pool fallback to be used.
+     */
+    inline void set_io_uring_enabled(bool enabled)
+    {
+      m_io_uring_enabled = enabled;
+    }
+
+    /**
+     * Loads files in given paths and passes them to given callback as their
+     * reads complete.
+     *
+     * If the callback throws an exception, no further calls are made. Reads
+     * which are already in flight are waited for and their files are closed
+     * before the exception is rethrown.
+     */
+    void load(const std::vector<std::string>& paths,
+              const callback_type& callback) const;
+
+    /**
+     * Loads files in given paths and returns their contents in the same
+     * order as the paths.
+     *
+     * \throws std::system_error If any of the files cannot be read
+     */
+    std::vector<runestring> load(const std::vector<std::string>& paths) const;
+
+  private:
+    unsigned m_queue_depth;
+    size_type m_memory_budget;
+    bool m_io_uring_enabled;
+  };
+}
+
+#endif /* !PEELO_TEXT_BATCH_LOADER_HPP_GUARD */
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEELO_TEXT_BATCH_WRITER_HPP_GUARD
+#define PEELO_TEXT_BATCH_WRITER_HPP_GUARD
+
+#include <peelo/text/runestring.hpp>
+
+namespace peelo
+{
+  /**
+   * Writes batches of rune strings into a file descriptor with UTF-8
+   * character encoding.
+   *
+   * The strings are encoded into a pool of fixed size segments, which are
+   * then written with a single <code>writev()</code> or
+   * <code>pwritev()</code> call whenever the pool fills up. The segments are
+   * kept between batches, so a writer which is used repeatedly does not
+   * allocate memory after the first batch.
+   */
+  class batch_writer
+  {
+  public:
+    typedef std::size_t size_type;
+
+    /**
+     * Constructs new batch writer.
+     *
+     * \param segment_size Size of a single segment in bytes.
+     * \param max_segments Number of segments which are filled before they
+     *                     are written.
+     */
+    explicit batch_writer(size_type segment_size = 64 * 1024,
+                          size_type max_segments = 16);
+
+    /**
+     * Writes given rune strings into given file descriptor at it's current
+     * file offset.
+     *
+     * \param separator Optional string written between the items.
+     * \param terminator Optional string written after each item.
+     * \param written   Optional vector which receives number of bytes
+     *                  written for each item, including the separator
+     *                  preceding the item and it's terminator.
+     * \return Total number of bytes written
+     * \throws std::system_error If writing fails
+     */
+    size_type write(int fd,
+                    const std::vector<runestring>& items,
+                    const runestring& separator = runestring(),
+                    const runestring& terminator = runestring(),
+                    std::vector<size_type>* written = nullptr);
+
+    /**
+     * Writes given rune strings into given file descriptor, beginning from
+     * given file offset. The file offset of the descriptor is not changed.
+     *
+     * \param separator Optional string written between the items.
+     * \param terminator Optional string written after each item.
+     * \param written   Optional vector which receives number of bytes
+     *                  written for each item, including the separator
+     *                  preceding the item and it's terminator.
+     * \return Total number of bytes written
+     * \throws std::system_error If writing fails
+     */
+    size_type write_at(int fd,
+                       size_type offset,
+                       const std::vector<runestring>& items,
+                       const runestring& separator = runestring(),
+                       const runestring& terminator = runestring(),
+                       std::vector<size_type>* written = nullptr);
+
+  private:
+    size_type write_items(const std::vector<runestring>& items,
+                          const runestring& separator,
+                          const runestring& terminator,
+                          std::vector<size_type>* written);
+
+    size_type append(const std::string& data);
+
+    size_type append(const runestring& str);
+
+    void flush();
+
+  private:
+    size_type m_segment_size;
+    size_type m_max_segments;
+    std::vector<std::vector<char>> m_segments;
+    size_type m_segment;
+    size_type m_used;
+    int m_fd;
+    bool m_positional;
+    size_type m_offset;
+  };
+}
+
+#endif /* !PEELO_TEXT_BATCH_WRITER_HPP_GUARD */
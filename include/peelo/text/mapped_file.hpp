@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEELO_TEXT_MAPPED_FILE_HPP_GUARD
+#define PEELO_TEXT_MAPPED_FILE_HPP_GUARD
+
+#include <cstddef>
+#include <string>
+
+namespace peelo
+{
+  /**
+   * Read-only memory mapped view of a file, used for decoding large UTF-8
+   * encoded files without reading them into an intermediate byte string.
+   *
+   * The mapping is created with a sequential access hint. Pages which have
+   * already been consumed can be handed back to the kernel with
+   * <code>release()</code>, which keeps the resident set small while the
+   * file is being decoded.
+   */
+  class mapped_file
+  {
+  public:
+    typedef std::size_t size_type;
+
+    /**
+     * Constructs empty mapping which is not associated with any file.
+     */
+    mapped_file();
+
+    /**
+     * Maps contents of the file in given path into memory.
+     *
+     * \throws std::system_error If the file cannot be opened or mapped
+     */
+    explicit mapped_file(const std::string& path);
+
+    mapped_file(const mapped_file&) = delete;
+
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    /**
+     * Destructor. Unmaps the file.
+     */
+    ~mapped_file();
+
+    /**
+     * Returns pointer to the beginning of the mapped file contents, or null
+     * pointer if the mapping is empty.
+     */
+    inline const char* data() const
+    {
+      return m_data;
+    }
+
+    /**
+     * Returns size of the mapped file in bytes.
+     */
+    inline size_type size() const
+    {
+      return m_size;
+    }
+
+    /**
+     * Returns <code>true</code> if the mapping is empty.
+     */
+    inline bool empty() const
+    {
+      return !m_size;
+    }
+
+    /**
+     * Tells the kernel that the given byte range of the mapping is no longer
+     * needed, allowing the pages to be dropped from the resident set. Both
+     * ends of the range are rounded down to page boundaries, unless the range
+     * reaches the end of the mapping, so releasing consecutive ranges drops
+     * every page exactly once, after the range containing its last byte has
+     * been released. The data remains readable; released pages are simply
+     * read again from the file if accessed.
+     */
+    void release(size_type offset, size_type count);
+
+    /**
+     * Unmaps the file. Contents of the mapping become inaccessible.
+     */
+    void close();
+
+  private:
+    const char* m_data;
+    size_type m_size;
+  };
+}
+
+#endif /* !PEELO_TEXT_MAPPED_FILE_HPP_GUARD */
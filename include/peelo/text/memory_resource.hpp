@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEELO_TEXT_MEMORY_RESOURCE_HPP_GUARD
+#define PEELO_TEXT_MEMORY_RESOURCE_HPP_GUARD
+
+#include <cstddef>
+#include <new>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+# if __has_include(<memory_resource>)
+#  include <memory_resource>
+#  define PEELO_TEXT_HAVE_STD_PMR 1
+# endif
+#endif
+
+namespace peelo
+{
+  /**
+   * Source of memory for rune string buffers. This has the same interface as
+   * <code>std::pmr::memory_resource</code> from C++17, which is not
+   * available in C++11.
+   */
+  class memory_resource
+  {
+  public:
+    virtual ~memory_resource();
+
+    /**
+     * Allocates at least <i>bytes</i> bytes of memory aligned to given
+     * alignment.
+     *
+     * \throw std::bad_alloc If the memory cannot be allocated
+     */
+    inline void* allocate(std::size_t bytes,
+                          std::size_t alignment = alignof(std::max_align_t))
+    {
+      return do_allocate(bytes, alignment);
+    }
+
+    /**
+     * Returns memory previously allocated from this resource with the same
+     * size and alignment.
+     */
+    inline void deallocate(void* p,
+                           std::size_t bytes,
+                           std::size_t alignment = alignof(std::max_align_t))
+    {
+      do_deallocate(p, bytes, alignment);
+    }
+
+    /**
+     * Returns <code>true</code> if memory allocated from this resource can
+     * be deallocated through given resource and vice versa.
+     */
+    inline bool is_equal(const memory_resource& that) const noexcept
+    {
+      return do_is_equal(that);
+    }
+
+  protected:
+    virtual void* do_allocate(std::size_t bytes, std::size_t alignment) = 0;
+
+    virtual void do_deallocate(void* p,
+                               std::size_t bytes,
+                               std::size_t alignment) = 0;
+
+    virtual bool do_is_equal(const memory_resource& that) const noexcept = 0;
+  };
+
+  /**
+   * Returns memory resource which uses global <code>operator new</code> and
+   * <code>operator delete</code>.
+   */
+  memory_resource* new_delete_resource() noexcept;
+
+  /**
+   * Returns memory resource which is used by the calling thread for new rune
+   * string buffers. Unlike in <code>std::pmr</code>, the default resource is
+   * set separately for each thread, so that request scoped resources do not
+   * affect other threads.
+   */
+  memory_resource* get_default_resource() noexcept;
+
+  /**
+   * Sets memory resource used by the calling thread for new rune string
+   * buffers and returns the previous one. Null pointer restores
+   * <code>new_delete_resource()</code>.
+   */
+  memory_resource* set_default_resource(memory_resource* resource) noexcept;
+
+  /**
+   * Sets default memory resource of the calling thread for lifetime of the
+   * scope object, restoring the previous one when the scope ends.
+   */
+  class memory_resource_scope
+  {
+  public:
+    explicit memory_resource_scope(memory_resource* resource)
+      : m_previous(set_default_resource(resource)) {}
+
+    ~memory_resource_scope()
+    {
+      set_default_resource(m_previous);
+    }
+
+    memory_resource_scope(const memory_resource_scope&) = delete;
+    memory_resource_scope& operator=(const memory_resource_scope&) = delete;
+
+  private:
+    memory_resource* m_previous;
+  };
+
+  /**
+   * Memory resource which carves allocations from large chunks obtained
+   * from an upstream resource. Deallocation does nothing; all of the memory
+   * is returned at once when the resource is released or destroyed. Like
+   * its standard counterpart, the resource is not thread safe.
+   *
+   * Rune strings allocated from the resource must either be destroyed or
+   * detached before the resource is released.
+   */
+  class monotonic_buffer_resource : public memory_resource
+  {
+  public:
+    /**
+     * Constructs new monotonic buffer resource.
+     *
+     * \param initial_size Size of the first chunk in bytes. Each following
+     *                     chunk is twice as large as the previous one.
+     * \param upstream     Resource where the chunks are allocated from.
+     */
+    explicit monotonic_buffer_resource(
+      std::size_t initial_size = 4096,
+      memory_resource* upstream = new_delete_resource()
+    );
+
+    ~monotonic_buffer_resource();
+
+    monotonic_buffer_resource(const monotonic_buffer_resource&) = delete;
+    monotonic_buffer_resource& operator=(
+      const monotonic_buffer_resource&
+    ) = delete;
+
+    /**
+     * Returns all chunks to the upstream resource.
+     */
+    void release();
+
+    /**
+     * Returns the upstream resource.
+     */
+    inline memory_resource* upstream_resource() const
+    {
+      return m_upstream;
+    }
+
+  protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment);
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment);
+
+    bool do_is_equal(const memory_resource& that) const noexcept;
+
+  private:
+    struct chunk;
+
+    memory_resource* m_upstream;
+    chunk* m_chunks;
+    std::size_t m_next_size;
+    char* m_current;
+    std::size_t m_available;
+  };
+
+  /**
+   * Allocator which obtains memory from a memory resource, used for
+   * containers of rune strings.
+   */
+  template<class T>
+  class polymorphic_allocator
+  {
+  public:
+    typedef T value_type;
+
+    polymorphic_allocator() noexcept
+      : m_resource(get_default_resource()) {}
+
+    polymorphic_allocator(memory_resource* resource) noexcept
+      : m_resource(resource) {}
+
+    template<class U>
+    polymorphic_allocator(const polymorphic_allocator<U>& that) noexcept
+      : m_resource(that.resource()) {}
+
+    inline T* allocate(std::size_t n)
+    {
+      return static_cast<T*>(
+        m_resource->allocate(n * sizeof(T), alignof(T))
+      );
+    }
+
+    inline void deallocate(T* p, std::size_t n)
+    {
+      m_resource->deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    inline memory_resource* resource() const
+    {
+      return m_resource;
+    }
+
+  private:
+    memory_resource* m_resource;
+  };
+
+  template<class T, class U>
+  inline bool operator==(const polymorphic_allocator<T>& a,
+                         const polymorphic_allocator<U>& b)
+  {
+    return a.resource() == b.resource()
+      || a.resource()->is_equal(*b.resource());
+  }
+
+  template<class T, class U>
+  inline bool operator!=(const polymorphic_allocator<T>& a,
+                         const polymorphic_allocator<U>& b)
+  {
+    return !(a == b);
+  }
+
+#if defined(PEELO_TEXT_HAVE_STD_PMR)
+  /**
+   * Adapts <code>std::pmr::memory_resource</code> for use with rune strings
+   * when compiling as C++17 or later.
+   */
+  class pmr_resource : public memory_resource
+  {
+  public:
+    explicit pmr_resource(std::pmr::memory_resource* resource)
+      : m_resource(resource) {}
+
+  protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment)
+    {
+      return m_resource->allocate(bytes, alignment);
+    }
+
+    void do_deallocate(void* p, std::size_t bytes, std::size_t alignment)
+    {
+      m_resource->deallocate(p, bytes, alignment);
+    }
+
+    bool do_is_equal(const memory_resource& that) const noexcept
+    {
+      const pmr_resource* other = dynamic_cast<const pmr_resource*>(&that);
+
+      return other && m_resource->is_equal(*other->m_resource);
+    }
+
+  private:
+    std::pmr::memory_resource* m_resource;
+  };
+#endif
+}
+
+#endif /* !PEELO_TEXT_MEMORY_RESOURCE_HPP_GUARD */
@@ -60,7 +60,7 @@ namespace peelo
     /**
      * Copy constructor.
      */
-    rune(const rune& that);
+    rune(const rune& that) = default;
 
     /**
      * Returns <code>true</code> if rune value is zero.
@@ -101,10 +101,7 @@ namespace peelo
     /**
      * Assignment operator.
      */
-    inline rune& operator=(const rune& that)
-    {
-      return assign(that);
-    }
+    rune& operator=(const rune& that) = default;
 
     /**
      * Assignment operator.
@@ -456,9 +453,19 @@ namespace peelo
      */
     rune operator--(int);
 
+  private:
+    struct unchecked_tag {};
+
+    /**
+     * Constructs rune from code point which is already known to be valid.
+     */
+    inline rune(value_type code, unchecked_tag)
+      : m_code(code) {}
+
   private:
     /** Unicode code point which this class represents. */
     value_type m_code;
+    friend class runestring;
   };
 
   /**
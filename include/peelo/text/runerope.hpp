@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEELO_TEXT_RUNEROPE_HPP_GUARD
+#define PEELO_TEXT_RUNEROPE_HPP_GUARD
+
+#include <peelo/text/runestring.hpp>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace peelo
+{
+  /**
+   * Rope of runes, intended for large documents which are edited
+   * frequently.
+   *
+   * The rope is a height balanced binary tree whose leaves are rune strings.
+   * Inserting, erasing, extracting substrings and accessing individual runes
+   * take logarithmic time, and since the leaves share buffers with the
+   * strings they were created from, inserting a large rune string into a
+   * rope does not copy it. Each node caches the number of runes and line
+   * feeds below it, which allows converting between positions and line
+   * numbers in logarithmic time as well.
+   *
+   * Nodes of the tree are immutable and shared between ropes, so copying a
+   * rope takes constant time regardless of it's length and modifying a copy
+   * leaves the original untouched. This makes copies suitable as snapshots
+   * of a document, for example for undo history.
+   */
+  class runerope
+  {
+  public:
+    typedef runestring::size_type size_type;
+    typedef rune value_type;
+
+    /**
+     * Constructs empty rope.
+     */
+    runerope();
+
+    /**
+     * Constructs rope from contents of given rune string.
+     */
+    explicit runerope(const runestring& str);
+
+    /**
+     * Constructs rope from given NUL terminated UTF-8 string.
+     */
+    explicit runerope(const char* input);
+
+    /**
+     * Returns number of runes in the rope.
+     */
+    size_type length() const;
+
+    /**
+     * Returns <code>true</code> if the rope is empty.
+     */
+    inline bool empty() const
+    {
+      return !m_root;
+    }
+
+    /**
+     * Returns number of lines in the rope, which is one more than the
+     * number of line feed characters in it.
+     */
+    size_type line_count() const;
+
+    /**
+     * Returns position of the first rune of given line. Lines are numbered
+     * from zero.
+     *
+     * \throws std::out_of_range If line number is out of bounds
+     */
+    size_type line_start(size_type line) const;
+
+    /**
+     * Returns number of the line which contains given position.
+     *
+     * \throws std::out_of_range If position is beyond end of the rope
+     */
+    size_type line_of(size_type pos) const;
+
+    /**
+     * Returns character from given position.
+     *
+     * \throws std::out_of_range If position is out of bounds
+     */
+    value_type at(size_type pos) const;
+
+    /**
+     * Returns character from given position.
+     *
+     * \throws std::out_of_range If position is out of bounds
+     */
+    inline value_type operator[](size_type pos) const
+    {
+      return at(pos);
+    }
+
+    /**
+     * Inserts contents of given rune string before given position.
+     *
+     * \throws std::out_of_range If position is beyond end of the rope
+     */
+    runerope& insert(size_type pos, const runestring& str);
+
+    /**
+     * Inserts contents of another rope before given position.
+     *
+     * \throws std::out_of_range If position is beyond end of the rope
+     */
+    runerope& insert(size_type pos, const runerope& that);
+
+    /**
+     * Appends contents of given rune string at the end of the rope.
+     */
+    runerope& append(const runestring& str);
+
+    /**
+     * Appends contents of another rope at the end of the rope.
+     */
+    runerope& append(const runerope& that);
+
+    /**
+     * Removes given number of runes beginning from given position. If count
+     * is omitted, everything to the end of the rope is removed.
+     *
+     * \throws std::out_of_range If position is beyond end of the rope
+     */
+    runerope& erase(size_type pos, size_type count = runestring::npos);
+
+    /**
+     * Returns part of the rope beginning from given position with given
+     * length. If length is omitted, the substring continues to the end of
+     * the rope.
+     *
+     * \throws std::out_of_range If position is beyond end of the rope
+     */
+    runerope substr(size_type pos,
+                    size_type count = runestring::npos) const;
+
+    /**
+     * Returns contents of the rope as rune string.
+     */
+    runestring str() const;
+
+    /**
+     * Encodes contents of the rope with UTF-8 character encoding.
+     */
+    std::string utf8() const;
+
+  private:
+    struct node;
+    typedef std::shared_ptr<const node> node_pointer;
+
+    explicit runerope(const node_pointer& root);
+
+    /**
+     * Constructs leaf node from given rune string.
+     */
+    static node_pointer make_leaf(const runestring& text);
+
+    /**
+     * Constructs inner node from two subtrees, without balancing them.
+     */
+    static node_pointer make_node(const node_pointer& left,
+                                  const node_pointer& right);
+
+    /**
+     * Constructs balanced tree from a rune string, splitting it into leaves
+     * of maximum length.
+     */
+    static node_pointer build(const runestring& text);
+
+    /**
+     * Constructs inner node from two subtrees whose heights differ by at
+     * most two, rotating them when required to keep the tree balanced.
+     */
+    static node_pointer balance(const node_pointer& left,
+                                const node_pointer& right);
+
+    /**
+     * Concatenates two balanced trees into one.
+     */
+    static node_pointer join(const node_pointer& left,
+                             const node_pointer& right);
+
+    /**
+     * Splits balanced tree into two before given position.
+     */
+    static std::pair<node_pointer, node_pointer> split(
+      const node_pointer& tree,
+      size_type pos
+    );
+
+    /**
+     * Calls given function with contents of each leaf of given tree, in
+     * order.
+     */
+    template<class Function>
+    static void for_each_leaf(const node* tree, const Function& function);
+
+  private:
+    node_pointer m_root;
+    friend std::ostream& operator<<(std::ostream&, const runerope&);
+  };
+
+  /**
+   * Writes contents of the rope into given stream with UTF-8 character
+   * encoding.
+   */
+  std::ostream& operator<<(std::ostream&, const runerope&);
+}
+
+#endif /* !PEELO_TEXT_RUNEROPE_HPP_GUARD */
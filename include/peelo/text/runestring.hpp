@@ -26,9 +26,26 @@
 #ifndef PEELO_TEXT_RUNESTRING_HPP_GUARD
 #define PEELO_TEXT_RUNESTRING_HPP_GUARD
 
+#include <peelo/text/memory_resource.hpp>
 #include <peelo/text/rune.hpp>
+#include <atomic>
+#include <cstdint>
+#include <initializer_list>
+#include <iterator>
+#include <utility>
 #include <vector>
 
+/**
+ * When enabled (the default), reference counters of shared rune buffers are
+ * updated atomically, which allows copies of the same rune string to be
+ * created and destroyed in different threads. Single threaded applications
+ * can disable this to avoid cost of the atomic operations. The memory layout
+ * of rune string is the same in both modes.
+ */
+#if !defined(PEELO_TEXT_ATOMIC_REFCOUNT)
+# define PEELO_TEXT_ATOMIC_REFCOUNT 1
+#endif
+
 namespace peelo
 {
   /**
@@ -37,8 +54,35 @@ namespace peelo
    * <h2>Memory model</h2>
    *
    * Rune string is implemented with copy-on-write memory model, meaning that
-   * several instances of rune string might share the container of runes, which
-   * might cause issues on threaded applications.
+   * several instances of rune string might share the container of runes.
+   * Unless <code>PEELO_TEXT_ATOMIC_REFCOUNT</code> has been disabled, the
+   * reference counter of the container is updated atomically, so rune strings
+   * can be shared between threads as long as no single instance is modified
+   * in one thread while being accessed in another.
+   *
+   * Short strings are stored inside the rune string object itself instead,
+   * which requires no memory allocation nor reference counting. Whether a
+   * string is stored inline depends solely on it's length, which is why
+   * substrings short enough to be stored inline are always copied.
+   *
+   * The rune string object itself is 16 bytes in size on 64-bit platforms.
+   * Offsets of strings in shared buffers are stored as 32-bit integers and
+   * lengths as 28-bit integers. Strings which don't fit into that are located
+   * through a separately allocated record instead.
+   *
+   * Buffers are allocated from the default memory resource of the thread
+   * which creates them, and returned to the same resource when they are no
+   * longer used. See <code>memory_resource_scope</code>.
+   *
+   * <h2>Storage width</h2>
+   *
+   * Runes are stored with one, two or four bytes each, depending on the
+   * largest code point of the string when it's created: strings which
+   * contain only Latin-1 characters use one byte per rune and strings which
+   * contain only characters from the Basic Multilingual Plane use two. This
+   * also means that up to 12 Latin-1 characters can be stored inline. Since
+   * runes are not stored as rune objects, characters are returned by value
+   * instead of by reference.
    */
   class runestring
   {
@@ -55,6 +99,16 @@ namespace peelo
     typedef std::reverse_iterator<iterator> reverse_iterator;
     typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
 
+    /**
+     * Result of bounded encoding: number of runes consumed from the string
+     * and number of bytes written into the output buffer.
+     */
+    struct encode_result
+    {
+      size_type runes;
+      size_type bytes;
+    };
+
     /**
      * Special value equal to maximum value representable by the
      * <code>size_type</code> type. Usually meaning as "no position",
@@ -73,6 +127,11 @@ namespace peelo
      */
     runestring(const runestring& that);
 
+    /**
+     * Move constructor. The moved-from string is left empty.
+     */
+    runestring(runestring&& that) noexcept;
+
     /**
      * Constructs rune string which contains <i>count</i> number of given rune.
      */
@@ -90,17 +149,336 @@ namespace peelo
      */
     runestring(const char* input);
 
+    /**
+     * Constructs rune string by decoding <i>size</i> bytes of UTF-8 encoded
+     * input. Unlike the C string constructor, embedded null bytes are
+     * decoded as runes. Decoding stops at the first invalid sequence.
+     */
+    runestring(const char* input, size_type size);
+
+    /**
+     * Constructs rune string from contents of the file in given path. The
+     * file is expected to be UTF-8 encoded.
+     *
+     * The file is memory mapped instead of being read into memory. Encoding
+     * of the file is first checked in order to find out the exact number of
+     * runes, after which the file is decoded straight into a single rune
+     * buffer. Pages of the file are released as soon as they have been
+     * decoded. Just like with the other UTF-8 constructors, decoding stops at
+     * the first invalid sequence.
+     *
+     * \throws std::system_error If the file cannot be opened or mapped
+     */
+    static runestring from_file(const std::string& path);
+
+    /**
+     * Decodes <i>size</i> bytes of UTF-8 encoded input using several threads.
+     * The input is split into chunks at sequence boundaries, runes in each
+     * chunk are counted in parallel, after which every chunk is decoded
+     * straight into its final position in a single rune buffer. The result is
+     * identical to the one produced by the <code>(const char*, size_type)
+     * </code> constructor.
+     *
+     * \param threads Number of threads to use, or zero to use the number of
+     *                hardware threads. Small inputs are always decoded in the
+     *                calling thread.
+     */
+    static runestring decode_parallel(const char* input,
+                                      size_type size,
+                                      unsigned threads = 0);
+
+    /**
+     * Joins rune strings from given range into a single rune string, with
+     * given separator between them. Length and storage width of the result
+     * are computed before anything is copied, so the result is allocated
+     * only once. The range is traversed twice, which is why forward
+     * iterators are required.
+     */
+    template<class ForwardIt>
+    static runestring join(const runestring& separator,
+                           ForwardIt first,
+                           ForwardIt last)
+    {
+      size_type count = 0;
+      size_type length = 0;
+      unsigned shift = 0;
+      runestring result;
+      unsigned char* runes;
+
+      for (ForwardIt it = first; it != last; ++it, ++count)
+      {
+        const runestring& str = *it;
+
+        length += str.length();
+        shift = str.shift() > shift ? str.shift() : shift;
+      }
+      if (count < 2)
+      {
+        return count ? runestring(*first) : result;
+      }
+      else if (!separator.empty())
+      {
+        length += (count - 1) * separator.length();
+        shift = separator.shift() > shift ? separator.shift() : shift;
+      }
+      runes = result.prepare(length, shift);
+      for (ForwardIt it = first; it != last; ++it)
+      {
+        const runestring& str = *it;
+
+        if (it != first)
+        {
+          runes = separator.copy_to(runes, shift);
+        }
+        runes = str.copy_to(runes, shift);
+      }
+
+      return result;
+    }
+
+    /**
+     * Joins rune strings from given range into a single rune string, with
+     * given separator between them.
+     */
+    template<class ForwardIt>
+    static inline runestring join(const_reference separator,
+                                  ForwardIt first,
+                                  ForwardIt last)
+    {
+      return join(runestring(1, separator), first, last);
+    }
+
+    /**
+     * Joins rune strings from given container into a single rune string,
+     * with given separator between them.
+     */
+    template<class Range>
+    static inline runestring join(const runestring& separator,
+                                  const Range& range)
+    {
+      return join(separator, std::begin(range), std::end(range));
+    }
+
+    /**
+     * Joins rune strings from given container into a single rune string,
+     * with given separator between them.
+     */
+    template<class Range>
+    static inline runestring join(const_reference separator,
+                                  const Range& range)
+    {
+      return join(
+        runestring(1, separator),
+        std::begin(range),
+        std::end(range)
+      );
+    }
+
+    /**
+     * Joins rune strings from given range into a single UTF-8 encoded byte
+     * string, with given separator between them. The encoded size is
+     * computed before anything is encoded, so the result is allocated only
+     * once.
+     */
+    template<class ForwardIt>
+    static std::string join_utf8(const runestring& separator,
+                                 ForwardIt first,
+                                 ForwardIt last)
+    {
+      const size_type separator_size = separator.utf8_size();
+      size_type size = 0;
+      std::string result;
+
+      for (ForwardIt it = first; it != last; ++it)
+      {
+        const runestring& str = *it;
+
+        if (it != first)
+        {
+          size += separator_size;
+        }
+        size += str.utf8_size();
+      }
+      result.reserve(size);
+      for (ForwardIt it = first; it != last; ++it)
+      {
+        const runestring& str = *it;
+
+        if (it != first)
+        {
+          separator.append_utf8(result);
+        }
+        str.append_utf8(result);
+      }
+
+      return result;
+    }
+
+    /**
+     * Joins rune strings from given range into a single UTF-8 encoded byte
+     * string, with given separator between them.
+     */
+    template<class ForwardIt>
+    static inline std::string join_utf8(const_reference separator,
+                                        ForwardIt first,
+                                        ForwardIt last)
+    {
+      return join_utf8(runestring(1, separator), first, last);
+    }
+
+    /**
+     * Joins rune strings from given container into a single UTF-8 encoded
+     * byte string, with given separator between them.
+     */
+    template<class Range>
+    static inline std::string join_utf8(const runestring& separator,
+                                        const Range& range)
+    {
+      return join_utf8(separator, std::begin(range), std::end(range));
+    }
+
+    /**
+     * Joins rune strings from given container into a single UTF-8 encoded
+     * byte string, with given separator between them.
+     */
+    template<class Range>
+    static inline std::string join_utf8(const_reference separator,
+                                        const Range& range)
+    {
+      return join_utf8(
+        runestring(1, separator),
+        std::begin(range),
+        std::end(range)
+      );
+    }
+
+    /**
+     * Argument of <code>format()</code>. Holds reference to or copy of the
+     * value given as an argument, without converting it into text.
+     */
+    class format_argument
+    {
+    public:
+      format_argument();
+
+      format_argument(const runestring& value);
+
+      format_argument(const char* value);
+
+      format_argument(const std::string& value);
+
+      format_argument(const rune& value);
+
+      format_argument(char value);
+
+      format_argument(bool value);
+
+      /**
+       * Pointers are not formatted. Without this, they would be converted
+       * into <code>bool</code>.
+       */
+      format_argument(const void* value) = delete;
+
+      format_argument(int value);
+
+      format_argument(long value);
+
+      format_argument(long long value);
+
+      format_argument(unsigned value);
+
+      format_argument(unsigned long value);
+
+      format_argument(unsigned long long value);
+
+      format_argument(double value);
+
+    private:
+      enum kind_type
+      {
+        kind_none,
+        kind_string,
+        kind_utf8,
+        kind_rune,
+        kind_bool,
+        kind_signed,
+        kind_unsigned,
+        kind_double
+      };
+
+      kind_type m_kind;
+      union
+      {
+        const runestring* string;
+        const char* input;
+        rune::value_type code;
+        bool boolean;
+        long long integer;
+        unsigned long long unsigned_integer;
+        double floating;
+      } m_value;
+      /** Size of UTF-8 encoded argument in bytes. */
+      size_type m_size;
+      friend class runestring;
+    };
+
+    /**
+     * Formats given arguments according to given pattern.
+     *
+     * Placeholders of the pattern are enclosed in curly braces, which can be
+     * escaped by doubling them. A placeholder can contain index of the
+     * argument, which defaults to the index following the previous
+     * placeholder, followed by a colon and format specification of form
+     * <code>[[fill]align][0][width][.precision][type]</code>:
+     *
+     * <ul>
+     *   <li><i>align</i> is <code>&lt;</code>, <code>&gt;</code> or
+     *       <code>^</code> for left, right or center alignment. Numbers are
+     *       aligned to the right and everything else to the left by
+     *       default.</li>
+     *   <li><i>fill</i> is any character used for padding, space by
+     *       default. Leading zero pads numbers with zeros after the
+     *       sign.</li>
+     *   <li><i>width</i> is minimum width of the field in runes.</li>
+     *   <li><i>precision</i> is number of digits after the decimal point of
+     *       a floating point number, or maximum number of runes taken from a
+     *       string.</li>
+     *   <li><i>type</i> is <code>d</code>, <code>x</code>, <code>X</code>,
+     *       <code>o</code> or <code>b</code> for integers and
+     *       <code>f</code>, <code>e</code> or <code>g</code> for floating
+     *       point numbers.</li>
+     * </ul>
+     *
+     * The pattern is processed twice: first to compute length and storage
+     * width of the result and then to write it, so that the result is
+     * allocated only once. Numbers are written straight into the result.
+     *
+     * \throws std::invalid_argument If the pattern is malformed
+     * \throws std::out_of_range     If placeholder refers to argument which
+     *                               does not exist
+     */
+    template<class... Args>
+    static runestring format(const runestring& pattern, const Args&... args)
+    {
+      const format_argument arguments[sizeof...(Args) + 1] = {
+        format_argument(args)...,
+        format_argument()
+      };
+
+      return format_arguments(pattern, arguments, sizeof...(Args));
+    }
+
     /**
      * Destructor.
      */
-    virtual ~runestring();
+    ~runestring();
 
     /**
      * Returns <code>true</code> if the string is not empty.
      */
     inline operator bool() const
     {
-      return !!m_length;
+      return !!(m_rep.small.header >> length_shift);
     }
 
     /**
@@ -108,7 +486,7 @@ namespace peelo
      */
     inline bool empty() const
     {
-      return !m_length;
+      return !(m_rep.small.header >> length_shift);
     }
 
     /**
@@ -122,37 +500,89 @@ namespace peelo
      */
     inline size_type length() const
     {
-      return m_length;
+      return is_large()
+        ? m_rep.large.location->length
+        : m_rep.small.header >> length_shift;
     }
 
     /**
-     * Returns reference to the first character in the string.
+     * Returns number of bytes used to store each rune of the string, which is
+     * either 1, 2 or 4.
+     */
+    inline size_type width() const
+    {
+      return size_type(1) << shift();
+    }
+
+    /**
+     * Returns the largest code point in the string, or zero if the string
+     * is empty.
+     */
+    rune::value_type max_code() const;
+
+    /**
+     * Returns <code>true</code> if the string contains only ASCII
+     * characters.
+     */
+    inline bool is_ascii() const
+    {
+      return max_code() < 0x80;
+    }
+
+    /**
+     * Returns <code>true</code> if the string contains only Latin-1
+     * characters.
+     */
+    inline bool is_latin1() const
+    {
+      return max_code() < 0x100;
+    }
+
+    /**
+     * Returns <code>true</code> if the string contains only characters from
+     * the Basic Multilingual Plane.
+     */
+    inline bool is_bmp() const
+    {
+      return max_code() < 0x10000;
+    }
+
+    /**
+     * Returns hash code of the string. The hash depends only on the code
+     * points, not on the storage width, so substrings hash equal to strings
+     * with the same contents. Hash of string which spans whole of it's
+     * shared buffer is cached in the buffer, so hashing long strings
+     * repeatedly takes constant time.
+     */
+    std::size_t hash() const;
+
+    /**
+     * Returns the first character in the string.
      *
      * \throw std::out_of_range If the string is empty
      */
-    const_reference front() const;
+    value_type front() const;
 
     /**
-     * Returns reference to the last character in the string.
+     * Returns the last character in the string.
      *
      * \throw std::out_of_range If the string is empty
      */
-    const_reference back() const;
+    value_type back() const;
 
     /**
-     * Returns reference to character from given index.
+     * Returns character from given index.
      *
      * \throw std::out_of_range If the given index is out of string limits
      */
-    const_reference at(size_type pos) const;
+    value_type at(size_type pos) const;
 
     /**
-     * Returns reference to character from given index. No boundary testing is
-     * performed.
+     * Returns character from given index. No boundary testing is performed.
      */
-    inline const_reference operator[](size_type pos) const
+    inline value_type operator[](size_type pos) const
     {
-      return m_runes[m_offset + pos];
+      return load(data(), shift(), pos);
     }
 
     /**
@@ -181,6 +611,12 @@ namespace peelo
      */
     runestring& assign(const runestring& that);
 
+    /**
+     * Replaces contents of rune string with contents moved from another rune
+     * string. The moved-from string is left empty.
+     */
+    runestring& assign(runestring&& that) noexcept;
+
     /**
      * Assignment operator.
      */
@@ -189,6 +625,14 @@ namespace peelo
       return assign(that);
     }
 
+    /**
+     * Move assignment operator.
+     */
+    inline runestring& operator=(runestring&& that) noexcept
+    {
+      return assign(std::move(that));
+    }
+
     /**
      * Tests whether contents of the rune string are equal with contents of
      * another rune string.
@@ -264,18 +708,49 @@ namespace peelo
     /**
      * Concatenates contents of two rune strings and returns result.
      */
-    runestring concat(const runestring& that) const;
+    runestring concat(const runestring& that) const &;
+
+    /**
+     * Concatenates contents of two rune strings and returns result. If the
+     * buffer of this string is not shared, it's reused for the result, and
+     * when it needs to grow, it grows with extra capacity so that repeated
+     * concatenations are amortized.
+     */
+    runestring concat(const runestring& that) &&;
 
     /**
      * Concatenates given rune at the end of the rune string and returns
      * result.
      */
-    runestring concat(const_reference r) const;
+    runestring concat(const_reference r) const &;
+
+    /**
+     * Concatenates given rune at the end of the rune string and returns
+     * result. If the buffer of this string is not shared, it's reused for
+     * the result, and when it needs to grow, it grows with extra capacity so
+     * that repeated concatenations are amortized.
+     */
+    runestring concat(const_reference r) &&;
+
+    /**
+     * Concatenates given rune strings, runes and UTF-8 encoded strings and
+     * returns result. Length and storage width of the result are computed
+     * before anything is copied, so that the operands are written into
+     * a single buffer of exact size. Chained <code>operator+</code> instead
+     * grows the result as each operand is appended.
+     */
+    template<class... Args>
+    static inline runestring concatenate(const Args&... args)
+    {
+      // Temporaries which the arguments are converted into live until the
+      // end of this full expression, so the operands can refer to them.
+      return concatenate_operands({ make_operand(args)... });
+    }
 
     /**
      * Concatenation operator.
      */
-    inline runestring operator+(const runestring& that) const
+    inline runestring operator+(const runestring& that) const &
     {
       return concat(that);
     }
@@ -283,33 +758,203 @@ namespace peelo
     /**
      * Concatenation operator.
      */
-    inline runestring operator+(const_reference r) const
+    inline runestring operator+(const runestring& that) &&
+    {
+      return std::move(*this).concat(that);
+    }
+
+    /**
+     * Concatenation operator.
+     */
+    inline runestring operator+(const_reference r) const &
     {
       return concat(r);
     }
 
+    /**
+     * Concatenation operator.
+     */
+    inline runestring operator+(const_reference r) &&
+    {
+      return std::move(*this).concat(r);
+    }
+
+    /**
+     * Concatenation operator for UTF-8 encoded string. The input is decoded
+     * directly into the result.
+     */
+    inline runestring operator+(const char* input) const &
+    {
+      return concatenate(*this, input);
+    }
+
+    /**
+     * Concatenation operator for UTF-8 encoded string.
+     */
+    runestring operator+(const char* input) &&;
+
+    /**
+     * Appends given rune at the end of the rune string.
+     *
+     * This and the other modifying members below change the string in place
+     * when it's buffer is not shared and has enough capacity. Otherwise the
+     * contents are first copied into a new buffer, which is allocated with
+     * extra capacity when the string grows, so that repeated modifications
+     * are amortized.
+     */
+    runestring& push_back(const_reference r);
+
+    /**
+     * Appends contents of another rune string at the end of the rune string.
+     */
+    runestring& append(const runestring& that);
+
+    /**
+     * Appends given rune at the end of the rune string.
+     */
+    inline runestring& append(const_reference r)
+    {
+      return push_back(r);
+    }
+
+    /**
+     * Appends given rune string at the end of the rune string.
+     */
+    inline runestring& operator+=(const runestring& that)
+    {
+      return append(that);
+    }
+
+    /**
+     * Appends given rune at the end of the rune string.
+     */
+    inline runestring& operator+=(const_reference r)
+    {
+      return push_back(r);
+    }
+
+    /**
+     * Inserts contents of another rune string before given position.
+     *
+     * \throws std::out_of_range If position is beyond end of the string
+     */
+    runestring& insert(size_type pos, const runestring& that);
+
+    /**
+     * Inserts given rune before given position.
+     *
+     * \throws std::out_of_range If position is beyond end of the string
+     */
+    runestring& insert(size_type pos, const_reference r);
+
+    /**
+     * Removes given number of runes beginning from given position. If count
+     * is omitted, everything to the end of the string is removed.
+     *
+     * \throws std::out_of_range If position is beyond end of the string
+     */
+    runestring& erase(size_type pos = 0, size_type count = npos);
+
+    /**
+     * Replaces rune in given position.
+     *
+     * \throws std::out_of_range If position is out of bounds
+     */
+    runestring& set(size_type pos, const_reference r);
+
+    /**
+     * Changes length of the rune string. If the string grows, new runes are
+     * filled with given rune.
+     */
+    runestring& resize(size_type length, const_reference r = rune());
+
+    /**
+     * Replaces given number of runes beginning from given position with
+     * contents of another rune string.
+     *
+     * \throws std::out_of_range If position is beyond end of the string
+     */
+    runestring& replace(size_type pos,
+                        size_type count,
+                        const runestring& str);
+
+    /**
+     * Replaces all non-overlapping occurrences of given needle with given
+     * replacement.
+     */
+    runestring& replace_all(const runestring& needle,
+                            const runestring& replacement);
+
+    /**
+     * Replaces all non-overlapping occurrences of several needles with
+     * their replacements at once. When more than one needle matches at the
+     * same position, the one listed first wins. Replacements are not
+     * searched for further matches.
+     *
+     * All matches are located in a single scan before anything is replaced,
+     * after which the result is written with a single allocation, or in
+     * place if the buffer of the string is not shared and every needle
+     * which was found has the same length as it's replacement.
+     */
+    runestring& replace_all(
+      const std::vector<std::pair<runestring, runestring>>& pairs
+    );
+
     /**
      * Strips whitespace from beginning and end of the rune string and returns
      * result.
      */
-    runestring trim() const;
+    runestring trim() const &;
+
+    /**
+     * Strips whitespace from beginning and end of the rune string and returns
+     * result. If the buffer of this string is not shared, the result takes
+     * it over without touching the reference counter.
+     */
+    runestring trim() &&;
 
     /**
      * Returns substring beginning from given position with given length. If
      * length if omitted, the substring will continue to the end of the
      * original source string.
+     *
+     * The substring shares storage with the original string, unless it's
+     * shorter than the retention threshold allows, in which case it's
+     * copied. See <code>set_retention_threshold()</code>.
      */
     runestring substr(size_type pos = 0, size_type count = npos) const;
 
     /**
      * Converts rune string to lower case and returns result.
      */
-    runestring to_lower() const;
+    runestring to_lower() const &;
+
+    /**
+     * Converts rune string to lower case and returns result. If the buffer
+     * of this string is not shared, it's converted in place.
+     */
+    runestring to_lower() &&;
 
     /**
      * Converts rune string to upper case and returns result.
      */
-    runestring to_upper() const;
+    runestring to_upper() const &;
+
+    /**
+     * Converts rune string to upper case and returns result. If the buffer
+     * of this string is not shared, it's converted in place.
+     */
+    runestring to_upper() &&;
+
+    /**
+     * Converts the rune string to lower case in place.
+     */
+    runestring& make_lower();
+
+    /**
+     * Converts the rune string to upper case in place.
+     */
+    runestring& make_upper();
 
     /**
      * Encodes string with UTF-8 character encoding and returns it as byte
@@ -341,6 +986,39 @@ namespace peelo
      */
     std::string utf32_le() const;
 
+    /**
+     * Encodes runes beginning from given position with UTF-8 character
+     * encoding into given buffer, until the string ends or the next rune
+     * would not fit into <i>budget</i> bytes. Runes are never split. Runes
+     * which cannot be encoded are skipped, just like in <code>utf8()</code>.
+     *
+     * Long string can be split into frames of bounded size by advancing the
+     * position with the number of runes consumed by each call.
+     */
+    encode_result encode_utf8_bounded(size_type pos,
+                                      size_type budget,
+                                      char* out) const;
+
+    /**
+     * Encodes runes beginning from given position with UTF-16BE character
+     * encoding into given buffer, until the string ends or the next rune
+     * would not fit into <i>budget</i> bytes. Surrogate pairs are never
+     * split, so a budget of N code units corresponds to 2N bytes.
+     */
+    encode_result encode_utf16_be_bounded(size_type pos,
+                                          size_type budget,
+                                          char* out) const;
+
+    /**
+     * Encodes runes beginning from given position with UTF-16LE character
+     * encoding into given buffer, until the string ends or the next rune
+     * would not fit into <i>budget</i> bytes. Surrogate pairs are never
+     * split, so a budget of N code units corresponds to 2N bytes.
+     */
+    encode_result encode_utf16_le_bounded(size_type pos,
+                                          size_type budget,
+                                          char* out) const;
+
     size_type find(const runestring& str, size_type pos = 0) const;
 
     size_type find(const_pointer s, size_type pos, size_type count) const;
@@ -360,17 +1038,520 @@ namespace peelo
      */
     std::vector<runestring> lines() const;
 
+    /**
+     * Extracts all lines from the rune string into a vector which is
+     * allocated from given memory resource.
+     */
+    std::vector<runestring, polymorphic_allocator<runestring>> lines(
+      memory_resource* resource
+    ) const;
+
     /**
      * Extracts all whitespace separated words from the rune string and returns
      * them in a vector of substrings.
      */
     std::vector<runestring> words() const;
 
+    /**
+     * Extracts all whitespace separated words from the rune string into a
+     * vector which is allocated from given memory resource.
+     */
+    std::vector<runestring, polymorphic_allocator<runestring>> words(
+      memory_resource* resource
+    ) const;
+
+    /**
+     * Returns the memory resource which storage of the string has been
+     * allocated from, or null pointer if the string is stored inline or
+     * refers to a string literal.
+     */
+    memory_resource* resource() const;
+
+    /**
+     * Returns copy of the string which does not share storage with any other
+     * string, allocated from given memory resource. This is used to keep
+     * strings which have been allocated from a short lived resource, such as
+     * a monotonic buffer resource, after the resource has been released.
+     */
+    runestring detach(
+      memory_resource* resource = new_delete_resource()
+    ) const;
+
+    /**
+     * Returns copy of the string with storage of it's own if the string
+     * occupies only part of a shared buffer, so that the string no longer
+     * keeps rest of the buffer alive. Otherwise the string itself is
+     * returned.
+     */
+    runestring compact() const;
+
+    /**
+     * Returns size of the buffer which contains the string in bytes, or zero
+     * if the string is stored inline or refers to a string literal. Compared
+     * to <code>length()</code> and <code>width()</code>, this tells how much
+     * memory the string keeps alive.
+     */
+    size_type buffer_size() const;
+
+    /**
+     * Returns number of rune strings sharing the buffer which contains the
+     * string, or zero if the string is stored inline or refers to a string
+     * literal.
+     */
+    size_type use_count() const;
+
+    /**
+     * Returns the retention threshold. See
+     * <code>set_retention_threshold()</code>.
+     */
+    static double retention_threshold();
+
+    /**
+     * Sets the fraction of buffer capacity below which substrings are copied
+     * instead of sharing the buffer, which prevents short substrings from
+     * keeping large buffers alive. Zero, the default, disables copying. The
+     * threshold applies to all threads and also affects the substrings
+     * returned by <code>trim()</code>, <code>lines()</code> and
+     * <code>words()</code>.
+     */
+    static void set_retention_threshold(double fraction);
+
   private:
-    size_type m_offset;
-    size_type m_length;
-    pointer m_runes;
-    size_type* m_counter;
+    /**
+     * Number of bytes available for runes of string which is stored inline
+     * instead of a shared buffer.
+     */
+    static const size_type small_size = 12;
+
+    /**
+     * The first 32 bits of each representation contain base 2 logarithm of
+     * the storage width in the lowest two bits, followed by two bits which
+     * tell which representation is being used and 28 bits for the length.
+     * Large strings have all of the length bits set.
+     */
+    static const std::uint32_t shift_mask = 0x3;
+    static const std::uint32_t mode_mask = 0xc;
+    static const std::uint32_t mode_small = 0x0;
+    static const std::uint32_t mode_heap = 0x4;
+    static const std::uint32_t mode_large = 0x8;
+    static const std::uint32_t mode_literal = 0xc;
+    static const unsigned length_shift = 4;
+    static const size_type max_heap_length = 0xfffffff;
+    static const size_type max_heap_offset = 0xffffffff;
+
+    /**
+     * Flags of shared rune buffer. Properties of the contents are computed
+     * when they are first needed. When <code>flag_valid</code> is set, the
+     * largest code point in the buffer is stored in the bits above
+     * <code>max_code_shift</code>. Since this applies to the whole buffer,
+     * it's also an upper bound for any substring sharing the buffer. The
+     * hash is only cached for strings which span the whole buffer.
+     */
+    static const unsigned flag_valid = 0x1;
+    static const unsigned flag_hashed = 0x2;
+    static const unsigned max_code_shift = 8;
+
+    /**
+     * Header of shared rune buffer. The header and the runes are allocated
+     * as a single block of memory, with the runes following the header.
+     */
+    struct buffer
+    {
+      /** Number of rune strings sharing the buffer. */
+      std::atomic<size_type> counter;
+      /** Number of runes the buffer has been allocated for. */
+      size_type capacity;
+      /** Number of runes written into the buffer. */
+      size_type length;
+      /** Cached properties of the contents. See <code>flag_valid</code>. */
+      std::atomic<unsigned> flags;
+      /** Base 2 logarithm of the storage width. */
+      unsigned shift;
+      /** Resource which the buffer has been allocated from. */
+      memory_resource* resource;
+      /** Cached hash of the contents, if <code>flag_hashed</code> is set. */
+      std::atomic<std::size_t> hash;
+
+      inline unsigned char* bytes()
+      {
+        return reinterpret_cast<unsigned char*>(this + 1);
+      }
+    };
+
+    /**
+     * Location of string whose offset or length does not fit into the rune
+     * string object. These are reference counted separately from the
+     * buffer.
+     */
+    struct large_location
+    {
+      std::atomic<size_type> counter;
+      buffer* storage;
+      size_type offset;
+      size_type length;
+    };
+
+    /**
+     * String of at most <code>small_size</code> bytes stored inline.
+     */
+    struct small_rep
+    {
+      std::uint32_t header;
+      unsigned char bytes[small_size];
+    };
+
+    /**
+     * String stored in a shared buffer.
+     */
+    struct heap_rep
+    {
+      std::uint32_t header;
+      std::uint32_t offset;
+      buffer* storage;
+    };
+
+    /**
+     * String stored in a shared buffer, with it's location stored
+     * separately.
+     */
+    struct large_rep
+    {
+      std::uint32_t header;
+      large_location* location;
+    };
+
+    /**
+     * String which refers to runes of a string literal. The runes have
+     * static storage duration, so they are neither reference counted nor
+     * ever modified.
+     */
+    struct literal_rep
+    {
+      std::uint32_t header;
+      std::uint32_t max_code;
+      const unsigned char* runes;
+    };
+
+    /**
+     * All representations begin with the 32-bit header, which tells which
+     * one of them is in use.
+     */
+    union representation
+    {
+      small_rep small;
+      heap_rep heap;
+      large_rep large;
+      literal_rep literal;
+    };
+
+    /**
+     * Returns base 2 logarithm of the storage width required by given code
+     * point.
+     */
+    static inline unsigned shift_of(rune::value_type code)
+    {
+      return code > 0xffff ? 2 : code > 0xff ? 1 : 0;
+    }
+
+    /**
+     * Reads code point from given index of runes stored with given width.
+     */
+    static inline value_type load(const unsigned char* runes,
+                                  unsigned shift,
+                                  size_type pos)
+    {
+      rune::value_type code;
+
+      switch (shift)
+      {
+        case 0:
+          code = runes[pos];
+          break;
+
+        case 1:
+          code = reinterpret_cast<const std::uint16_t*>(runes)[pos];
+          break;
+
+        default:
+          code = reinterpret_cast<const std::uint32_t*>(runes)[pos];
+          break;
+      }
+
+      return rune(code, rune::unchecked_tag());
+    }
+
+    /**
+     * Allocates new buffer for given number of runes with given width.
+     * Reference counter of the buffer is initialized to one.
+     */
+    static buffer* allocate(size_type capacity, unsigned shift);
+
+    /**
+     * Decrements reference counter of given buffer and frees the buffer once
+     * it's no longer used.
+     */
+    static void release(buffer* storage);
+
+    /**
+     * Sets length and storage width of empty string and allocates storage
+     * for the runes if required. Buffer is allocated with at least given
+     * capacity. Returns pointer to the storage.
+     */
+    unsigned char* prepare(size_type length,
+                           unsigned shift,
+                           size_type capacity = 0);
+
+    /**
+     * Makes empty string refer to given range of runes with given width in
+     * given buffer. The string takes over one reference to the buffer.
+     */
+    void locate(buffer* storage,
+                size_type offset,
+                size_type length,
+                unsigned shift);
+
+    /**
+     * Makes empty string refer to given runes with static storage duration.
+     * The length must be below <code>max_heap_length</code>.
+     */
+    void refer(const unsigned char* runes,
+               size_type length,
+               unsigned shift,
+               rune::value_type max_code);
+
+    /**
+     * Increments reference counter of the buffer used by the string.
+     */
+    void retain();
+
+    /**
+     * Decrements reference counter of the buffer used by the string and
+     * frees the buffer once it's no longer used.
+     */
+    void release();
+
+    /**
+     * Returns <code>true</code> if no other rune string shares the storage
+     * of this string.
+     */
+    bool is_unique() const;
+
+    /**
+     * Returns <code>true</code> if the string can be extended in place to
+     * given length with runes of given width without affecting other rune
+     * strings.
+     */
+    bool is_extensible(size_type length, unsigned shift) const;
+
+    /**
+     * Returns <code>true</code> if the string spans all of the runes written
+     * into it's buffer.
+     */
+    inline bool is_whole() const
+    {
+      return !offset() && length() == storage()->length;
+    }
+
+    /**
+     * Returns upper bound for the code points of the string, using the
+     * cached properties of the buffer when the string is not stored inline.
+     */
+    rune::value_type max_code_bound() const;
+
+    /**
+     * Invalidates cached properties of the buffer after the string has been
+     * modified in place.
+     */
+    void modified();
+
+    /**
+     * Copies runes of the string into given storage of given width, which
+     * must be at least as wide as the string. Returns pointer to the end of
+     * the copied runes.
+     */
+    unsigned char* copy_to(unsigned char* runes, unsigned shift) const;
+
+    /**
+     * Operand of <code>concatenate()</code>: either a rune string, UTF-8
+     * encoded string or a single code point.
+     */
+    struct concat_operand
+    {
+      const runestring* string;
+      const char* input;
+      rune::value_type code;
+      size_type length;
+      size_type size;
+      unsigned shift;
+    };
+
+    static concat_operand make_operand(const runestring& string);
+
+    static concat_operand make_operand(const_reference r);
+
+    static concat_operand make_operand(const char* input);
+
+    /**
+     * Implementation of <code>concatenate()</code>.
+     */
+    static runestring concatenate_operands(
+      std::initializer_list<concat_operand> operands
+    );
+
+    /**
+     * Implementation of <code>format()</code>.
+     */
+    static runestring format_arguments(const runestring& pattern,
+                                       const format_argument* arguments,
+                                       size_type count);
+
+    /**
+     * Parses the pattern and passes the pieces of the result into given
+     * sink.
+     */
+    template<class Sink>
+    static void format_fields(const runestring& pattern,
+                              const format_argument* arguments,
+                              size_type count,
+                              Sink& sink);
+
+    /**
+     * Returns number of bytes required to encode the string with UTF-8
+     * character encoding.
+     */
+    size_type utf8_size() const;
+
+    /**
+     * Encodes the string with UTF-8 character encoding and appends the
+     * result into given byte string.
+     */
+    void append_utf8(std::string& output) const;
+
+    /**
+     * Removes given number of runes beginning from given position and makes
+     * room for given number of runes of given width in their place. The
+     * string is modified in place when possible and copied otherwise.
+     * Returns pointer to the room, which uses storage width of the resulting
+     * string.
+     */
+    unsigned char* splice(size_type pos,
+                          size_type removed,
+                          size_type inserted,
+                          unsigned shift);
+
+    /**
+     * Returns copy of the string with given function applied to each code
+     * point. Storage width of the result is widened if required.
+     */
+    runestring transform(
+      rune::value_type (*function)(rune::value_type)
+    ) const &;
+
+    /**
+     * Applies given function to each code point of the string, modifying
+     * the string in place when it's not shared with other strings.
+     */
+    runestring transform(rune::value_type (*function)(rune::value_type)) &&;
+
+    /**
+     * Constructs wider copy of <i>source</i> where first <i>done</i> runes
+     * are taken from this string, which contains them already converted,
+     * and the rest are converted with given function.
+     */
+    runestring widen(size_type done,
+                     const runestring& source,
+                     rune::value_type (*function)(rune::value_type)) const;
+
+    /**
+     * Returns <code>true</code> if substring of given length should be
+     * copied instead of sharing the buffer of this string, as set by the
+     * retention threshold.
+     */
+    bool is_retention_limited(size_type length) const;
+
+    /**
+     * Returns base 2 logarithm of the storage width.
+     */
+    inline unsigned shift() const
+    {
+      return m_rep.small.header & shift_mask;
+    }
+
+    /**
+     * Returns <code>true</code> if the string is stored inline.
+     */
+    inline bool is_small() const
+    {
+      return (m_rep.small.header & mode_mask) == mode_small;
+    }
+
+    /**
+     * Returns <code>true</code> if location of the string is stored outside
+     * of the rune string object.
+     */
+    inline bool is_large() const
+    {
+      return (m_rep.small.header & mode_mask) == mode_large;
+    }
+
+    /**
+     * Returns <code>true</code> if the string refers to a string literal.
+     */
+    inline bool is_literal() const
+    {
+      return (m_rep.small.header & mode_mask) == mode_literal;
+    }
+
+    /**
+     * Returns the buffer which contains the string. Not applicable to small
+     * strings nor literals.
+     */
+    inline buffer* storage() const
+    {
+      return is_large() ? m_rep.large.location->storage : m_rep.heap.storage;
+    }
+
+    /**
+     * Returns offset of the string in it's buffer. Not applicable to small
+     * strings nor literals.
+     */
+    inline size_type offset() const
+    {
+      return is_large() ? m_rep.large.location->offset : m_rep.heap.offset;
+    }
+
+    /**
+     * Returns pointer to the first rune of the string.
+     */
+    inline const unsigned char* data() const
+    {
+      return is_small()
+        ? m_rep.small.bytes
+        : is_literal()
+        ? m_rep.literal.runes
+        : storage()->bytes() + (offset() << shift());
+    }
+
+    /**
+     * Returns pointer to the first rune of the string. Runes of a literal
+     * must not be written through the pointer, which is never done as
+     * literals are never unique.
+     */
+    inline unsigned char* data()
+    {
+      return is_small()
+        ? m_rep.small.bytes
+        : is_literal()
+        ? const_cast<unsigned char*>(m_rep.literal.runes)
+        : storage()->bytes() + (offset() << shift());
+    }
+
+  private:
+    representation m_rep;
+    friend class runerope;
+    friend class runestring_builder;
+    friend runestring operator""_rs(const char*, std::size_t);
+    friend runestring operator""_rs(const char32_t*, std::size_t);
   };
 
   /**
@@ -382,24 +1563,40 @@ namespace peelo
     value_type,
     difference_type,
     const_pointer,
-    const_reference
+    value_type
   >
   {
   public:
+    /**
+     * Holds copy of the character an iterator points to, so that members
+     * of the character can be accessed through the iterator.
+     */
+    struct arrow
+    {
+      value_type value;
+
+      inline const_pointer operator->() const
+      {
+        return &value;
+      }
+    };
+
     iterator();
 
     iterator(const iterator& that);
 
     iterator& operator=(const iterator& that);
 
-    inline const_reference operator*() const
+    inline value_type operator*() const
     {
-      return *m_pointer;
+      return load(m_pointer, m_shift, 0);
     }
 
-    inline const_pointer operator->() const
+    inline arrow operator->() const
     {
-      return m_pointer;
+      arrow result = { load(m_pointer, m_shift, 0) };
+
+      return result;
     }
 
     iterator& operator++();
@@ -440,9 +1637,9 @@ namespace peelo
       return m_pointer >= that.m_pointer;
     }
 
-    inline const_reference operator[](size_type n) const
+    inline value_type operator[](size_type n) const
     {
-      return m_pointer[n];
+      return load(m_pointer, m_shift, n);
     }
 
     iterator operator+(size_type n) const;
@@ -456,13 +1653,59 @@ namespace peelo
     difference_type operator-(const iterator& that) const;
 
   private:
-    pointer m_pointer;
+    const unsigned char* m_pointer;
+    unsigned m_shift;
     friend class runestring;
   };
 
+  /**
+   * Concatenation operator for UTF-8 encoded string and rune string.
+   */
+  runestring operator+(const char*, const runestring&);
+
+  /**
+   * Constructs rune string from string literal. Literal consisting only of
+   * ASCII characters is not decoded nor copied; the rune string refers to
+   * the bytes of the literal directly. Copying, comparing and destroying
+   * such rune string never allocates memory nor updates reference counters.
+   * Other literals are decoded from UTF-8 as usual.
+   *
+   * Given pointer must point to storage with static storage duration, which
+   * is always the case when the operator is used through literal syntax such
+   * as <code>"GET"_rs</code>.
+   */
+  runestring operator""_rs(const char*, std::size_t);
+
+  /**
+   * Constructs rune string from UTF-32 string literal, such as
+   * <code>U"\u00e4iti"_rs</code>. The rune string refers to the code points
+   * of the literal directly, without copying them.
+   *
+   * \throws std::out_of_range If the literal contains too large code point
+   */
+  runestring operator""_rs(const char32_t*, std::size_t);
+
   std::ostream& operator<<(std::ostream&, const runestring&);
 
   std::istream& getline(std::istream&, runestring&);
 }
 
+namespace std
+{
+  /**
+   * Allows rune strings to be used as keys of unordered containers.
+   */
+  template<>
+  struct hash<peelo::runestring>
+  {
+    typedef peelo::runestring argument_type;
+    typedef std::size_t result_type;
+
+    inline result_type operator()(const argument_type& str) const
+    {
+      return str.hash();
+    }
+  };
+}
+
 #endif /* !PEELO_TEXT_RUNESTRING_HPP_GUARD */
@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEELO_TEXT_RUNESTRING_BUILDER_HPP_GUARD
+#define PEELO_TEXT_RUNESTRING_BUILDER_HPP_GUARD
+
+#include <peelo/text/runestring.hpp>
+#include <string>
+
+namespace peelo
+{
+  /**
+   * Constructs rune strings incrementally.
+   *
+   * The builder owns a single rune buffer which grows geometrically as
+   * content is appended, so building a string from N pieces takes amortized
+   * linear time. Storage width of the buffer is widened when a character
+   * which does not fit into it is appended. <code>str()</code> hands the
+   * buffer over to the resulting rune string without copying the runes.
+   */
+  class runestring_builder
+  {
+  public:
+    typedef runestring::size_type size_type;
+
+    /**
+     * Constructs empty builder. No memory is allocated until something is
+     * appended into the builder.
+     */
+    runestring_builder();
+
+    /**
+     * Constructs empty builder with room for given number of runes.
+     */
+    explicit runestring_builder(size_type capacity);
+
+    runestring_builder(const runestring_builder&) = delete;
+
+    /**
+     * Move constructor.
+     */
+    runestring_builder(runestring_builder&& that) noexcept;
+
+    /**
+     * Destructor.
+     */
+    ~runestring_builder();
+
+    runestring_builder& operator=(const runestring_builder&) = delete;
+
+    /**
+     * Move assignment operator.
+     */
+    runestring_builder& operator=(runestring_builder&& that) noexcept;
+
+    /**
+     * Returns number of runes appended into the builder.
+     */
+    inline size_type length() const
+    {
+      return m_length;
+    }
+
+    /**
+     * Returns <code>true</code> if nothing has been appended into the
+     * builder.
+     */
+    inline bool empty() const
+    {
+      return !m_length;
+    }
+
+    /**
+     * Returns number of runes the builder can hold with it's current storage
+     * width without allocating more memory.
+     */
+    size_type capacity() const;
+
+    /**
+     * Ensures that the builder can hold at least given number of runes
+     * without allocating more memory.
+     */
+    void reserve(size_type capacity);
+
+    /**
+     * Removes all contents from the builder. The buffer is kept, so that the
+     * builder can be reused without allocating memory.
+     */
+    void clear();
+
+    /**
+     * Returns contents of the builder as rune string and leaves the builder
+     * empty. The buffer of the builder is transferred into the returned
+     * string, unless the string is short enough to be stored inline, in
+     * which case the buffer is kept for reuse.
+     */
+    runestring str();
+
+    /**
+     * Appends single character.
+     */
+    runestring_builder& append(const rune& r);
+
+    /**
+     * Appends single character given as it's Latin-1 code. Without this,
+     * characters would be appended as integers.
+     */
+    inline runestring_builder& append(char c)
+    {
+      return append(rune(static_cast<unsigned char>(c)));
+    }
+
+    /**
+     * Appends given character given number of times.
+     */
+    runestring_builder& append(size_type count, const rune& r);
+
+    /**
+     * Appends contents of rune string.
+     */
+    runestring_builder& append(const runestring& str);
+
+    /**
+     * Decodes given NUL terminated UTF-8 string and appends the result.
+     */
+    runestring_builder& append(const char* input);
+
+    /**
+     * Decodes given UTF-8 string and appends the result. Decoding stops at
+     * the first invalid sequence.
+     */
+    runestring_builder& append(const char* input, size_type size);
+
+    /**
+     * Decodes given UTF-8 string and appends the result.
+     */
+    inline runestring_builder& append(const std::string& input)
+    {
+      return append(input.data(), input.size());
+    }
+
+    /**
+     * Appends decimal representation of given integer.
+     */
+    runestring_builder& append(int value);
+
+    /**
+     * Appends decimal representation of given integer.
+     */
+    runestring_builder& append(long value);
+
+    /**
+     * Appends decimal representation of given integer.
+     */
+    runestring_builder& append(long long value);
+
+    /**
+     * Appends decimal representation of given integer.
+     */
+    runestring_builder& append(unsigned value);
+
+    /**
+     * Appends decimal representation of given integer.
+     */
+    runestring_builder& append(unsigned long value);
+
+    /**
+     * Appends decimal representation of given integer.
+     */
+    runestring_builder& append(unsigned long long value);
+
+    /**
+     * Appends given value into the builder.
+     */
+    template<class T>
+    inline runestring_builder& operator<<(const T& value)
+    {
+      return append(value);
+    }
+
+  private:
+    /**
+     * Makes room for given number of runes of given width at the end of the
+     * buffer, widening and growing the buffer when required, and returns
+     * pointer to the first of them.
+     */
+    unsigned char* extend(size_type count, unsigned shift);
+
+    runestring_builder& append_integer(unsigned long long value,
+                                       bool negative);
+
+  private:
+    runestring::buffer* m_buffer;
+    size_type m_length;
+  };
+}
+
+#endif /* !PEELO_TEXT_RUNESTRING_BUILDER_HPP_GUARD */
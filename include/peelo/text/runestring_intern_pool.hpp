@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEELO_TEXT_RUNESTRING_INTERN_POOL_HPP_GUARD
+#define PEELO_TEXT_RUNESTRING_INTERN_POOL_HPP_GUARD
+
+#include <peelo/text/runestring.hpp>
+#include <memory>
+#include <string>
+
+namespace peelo
+{
+  /**
+   * Pool of unique rune strings.
+   *
+   * Interning a string returns the instance of the string which is kept in
+   * the pool, so equal strings interned through the same pool share a
+   * single buffer and comparing them does not need to look at the runes.
+   * Each distinct string also receives a symbol, which is a small integer
+   * that can be compared, hashed and stored instead of the string itself.
+   *
+   * Strings are looked up by their UTF-8 encoded bytes, so interning UTF-8
+   * input which is already in the pool neither decodes the input nor
+   * allocates memory. Input which is not in the shortest form, or which
+   * contains invalid sequences, is decoded first and looked up by the
+   * encoding of the result, so equal strings always share one symbol. The pool is divided into shards, each protected by
+   * a mutex of it's own, so it can be used from multiple threads at once.
+   * Strings are never removed from the pool.
+   */
+  class runestring_intern_pool
+  {
+  public:
+    typedef runestring::size_type size_type;
+    typedef std::uint32_t symbol_type;
+
+    /**
+     * Constructs empty pool. Given number of shards is rounded up to the
+     * next power of two.
+     */
+    explicit runestring_intern_pool(size_type shards = 16);
+
+    runestring_intern_pool(const runestring_intern_pool&) = delete;
+
+    /**
+     * Destructor.
+     */
+    ~runestring_intern_pool();
+
+    runestring_intern_pool& operator=(const runestring_intern_pool&) = delete;
+
+    /**
+     * Returns number of distinct strings in the pool.
+     */
+    size_type size() const;
+
+    /**
+     * Returns the instance of given string kept in the pool, adding the
+     * string into the pool if it's not there yet.
+     */
+    runestring intern(const runestring& str);
+
+    /**
+     * Returns the instance of string decoded from null terminated UTF-8
+     * encoded input kept in the pool.
+     */
+    runestring intern(const char* input);
+
+    /**
+     * Returns the instance of string decoded from <i>size</i> bytes of
+     * UTF-8 encoded input kept in the pool. Just like with rune string
+     * constructors, decoding stops at the first invalid sequence.
+     */
+    runestring intern(const char* input, size_type size);
+
+    /**
+     * Returns the instance of string decoded from UTF-8 encoded input kept
+     * in the pool.
+     */
+    runestring intern(const std::string& input);
+
+    /**
+     * Returns symbol of given string, adding the string into the pool if
+     * it's not there yet.
+     *
+     * \throws std::length_error If the pool has run out of symbols
+     */
+    symbol_type symbol(const runestring& str);
+
+    /**
+     * Returns symbol of string decoded from null terminated UTF-8 encoded
+     * input.
+     */
+    symbol_type symbol(const char* input);
+
+    /**
+     * Returns symbol of string decoded from <i>size</i> bytes of UTF-8
+     * encoded input.
+     */
+    symbol_type symbol(const char* input, size_type size);
+
+    /**
+     * Returns symbol of string decoded from UTF-8 encoded input.
+     */
+    symbol_type symbol(const std::string& input);
+
+    /**
+     * Returns the string identified by given symbol.
+     *
+     * \throws std::out_of_range If the symbol has not been issued by the
+     *                           pool
+     */
+    runestring str(symbol_type symbol) const;
+
+  private:
+    struct entry;
+    struct shard;
+
+    const entry& lookup(const runestring& str);
+
+    const entry& lookup(const char* input, size_type size);
+
+    const entry& insert(const char* input,
+                        size_type size,
+                        std::size_t hash,
+                        const runestring& str);
+
+  private:
+    std::unique_ptr<std::unique_ptr<shard>[]> m_shards;
+    unsigned m_shard_bits;
+  };
+}
+
+#endif /* !PEELO_TEXT_RUNESTRING_INTERN_POOL_HPP_GUARD */
@@ -0,0 +1,354 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#ifndef PEELO_TEXT_UTF8_RUNESTRING_HPP_GUARD
+#define PEELO_TEXT_UTF8_RUNESTRING_HPP_GUARD
+
+#include <peelo/text/runestring.hpp>
+#include <memory>
+
+namespace peelo
+{
+  /**
+   * Unicode string which keeps it's contents in UTF-8 encoded form.
+   *
+   * Unlike rune string, UTF-8 rune string does not decode it's input, which
+   * makes it suitable for large documents that are mostly streamed, searched
+   * and written out again. Positions are still given in runes. They are
+   * mapped into byte offsets through a sparse index which contains byte
+   * offset of every 64th rune. The index is built on first use and shared
+   * by all copies and substrings of the string, so random access, length and
+   * substrings take amortized constant time.
+   *
+   * Just like rune string, decoding stops at the first invalid sequence and
+   * the bytes after it are not part of the string. Overlong sequences are
+   * accepted and kept as they are, but comparison and search operate on the
+   * decoded runes, so they give the same results as with rune string.
+   */
+  class utf8_runestring
+  {
+  public:
+    typedef std::size_t size_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef rune value_type;
+    typedef const rune& const_reference;
+    struct iterator;
+    typedef iterator const_iterator;
+
+    /**
+     * Special value returned by search methods when the value being looked
+     * for is not found.
+     */
+    static const size_type npos;
+
+    /**
+     * Constructs empty string.
+     */
+    explicit utf8_runestring();
+
+    /**
+     * Constructs string from UTF-8 encoded bytes, which are copied.
+     */
+    explicit utf8_runestring(const std::string& input);
+
+    /**
+     * Constructs string from UTF-8 encoded bytes, taking over the given
+     * string without copying it.
+     */
+    explicit utf8_runestring(std::string&& input);
+
+    /**
+     * Constructs string from null terminated UTF-8 encoded input.
+     */
+    utf8_runestring(const char* input);
+
+    /**
+     * Constructs string from <i>size</i> bytes of UTF-8 encoded input.
+     */
+    utf8_runestring(const char* input, size_type size);
+
+    /**
+     * Constructs string by encoding given rune string.
+     */
+    explicit utf8_runestring(const runestring& str);
+
+    /**
+     * Returns <code>true</code> if the string is empty.
+     */
+    bool empty() const;
+
+    /**
+     * Returns length of the string in runes.
+     */
+    size_type length() const;
+
+    /**
+     * Returns size of the string in bytes.
+     */
+    size_type size() const;
+
+    /**
+     * Returns pointer to the UTF-8 encoded bytes of the string. The bytes
+     * are not null terminated.
+     */
+    const char* data() const;
+
+    /**
+     * Returns the first character in the string.
+     *
+     * \throw std::out_of_range If the string is empty
+     */
+    value_type front() const;
+
+    /**
+     * Returns the last character in the string.
+     *
+     * \throw std::out_of_range If the string is empty
+     */
+    value_type back() const;
+
+    /**
+     * Returns character from given index.
+     *
+     * \throw std::out_of_range If the given index is out of string limits
+     */
+    value_type at(size_type pos) const;
+
+    /**
+     * Returns character from given index. No boundary testing is performed.
+     */
+    value_type operator[](size_type pos) const;
+
+    /**
+     * Returns iterator that points to the beginning of the string.
+     */
+    iterator begin() const;
+
+    /**
+     * Returns iterator that points past contents of the string.
+     */
+    iterator end() const;
+
+    /**
+     * Tests whether two strings are equal.
+     */
+    bool equals(const utf8_runestring& that) const;
+
+    /**
+     * Tests whether two strings are equal, ignoring case differences.
+     */
+    bool equals_icase(const utf8_runestring& that) const;
+
+    /**
+     * Equality testing operator.
+     */
+    inline bool operator==(const utf8_runestring& that) const
+    {
+      return equals(that);
+    }
+
+    /**
+     * Non-equality testing operator.
+     */
+    inline bool operator!=(const utf8_runestring& that) const
+    {
+      return !equals(that);
+    }
+
+    /**
+     * Compares two strings lexicographically by code points.
+     */
+    int compare(const utf8_runestring& that) const;
+
+    /**
+     * Compares two strings lexicographically by code points, ignoring case
+     * differences.
+     */
+    int compare_icase(const utf8_runestring& that) const;
+
+    /**
+     * Comparison operator.
+     */
+    inline bool operator<(const utf8_runestring& that) const
+    {
+      return compare(that) < 0;
+    }
+
+    /**
+     * Comparison operator.
+     */
+    inline bool operator>(const utf8_runestring& that) const
+    {
+      return compare(that) > 0;
+    }
+
+    /**
+     * Comparison operator.
+     */
+    inline bool operator<=(const utf8_runestring& that) const
+    {
+      return compare(that) <= 0;
+    }
+
+    /**
+     * Comparison operator.
+     */
+    inline bool operator>=(const utf8_runestring& that) const
+    {
+      return compare(that) >= 0;
+    }
+
+    /**
+     * Returns substring of the string. The substring shares the bytes and
+     * the index of this string.
+     */
+    utf8_runestring substr(size_type pos = 0, size_type count = npos) const;
+
+    /**
+     * Searches for the first occurrence of given substring, beginning from
+     * given position. Both the position and the returned value are counted
+     * in runes, not bytes.
+     *
+     * \return Position of the first rune of the match, or <code>npos</code>
+     *         if the substring was not found
+     */
+    size_type find(const utf8_runestring& str, size_type pos = 0) const;
+
+    /**
+     * Searches for the first occurrence of given rune, beginning from given
+     * position, which is counted in runes.
+     *
+     * \return Position of the rune, or <code>npos</code> if the rune was
+     *         not found
+     */
+    size_type find(const_reference needle, size_type pos = 0) const;
+
+    /**
+     * Searches for the last occurrence of given substring which begins at
+     * or before given position. Both the position and the returned value
+     * are counted in runes, not bytes.
+     *
+     * \return Position of the first rune of the match, or <code>npos</code>
+     *         if the substring was not found
+     */
+    size_type rfind(const utf8_runestring& str, size_type pos = npos) const;
+
+    /**
+     * Searches for the last occurrence of given rune at or before given
+     * position, which is counted in runes.
+     *
+     * \return Position of the rune, or <code>npos</code> if the rune was
+     *         not found
+     */
+    size_type rfind(const_reference needle, size_type pos = npos) const;
+
+    /**
+     * Returns copy of the UTF-8 encoded bytes of the string. Use
+     * <code>data()</code> and <code>size()</code> to access the bytes
+     * without copying them.
+     */
+    std::string utf8() const;
+
+    /**
+     * Decodes the string into rune string.
+     */
+    runestring runes() const;
+
+  private:
+    struct storage;
+
+    /**
+     * Returns <code>true</code> if every rune in the storage of the string
+     * is encoded with the shortest possible sequence, in which case the
+     * bytes can be compared and searched instead of the runes.
+     */
+    bool canonical() const;
+
+    /**
+     * Returns byte offset of the beginning of the string in it's storage.
+     */
+    size_type begin_offset() const;
+
+    /**
+     * Returns byte offset of the end of the string in it's storage.
+     */
+    size_type end_offset() const;
+
+  private:
+    /** Shared bytes and index, or null if the string is empty. */
+    std::shared_ptr<storage> m_storage;
+    /** Position of the first rune of the string in it's storage. */
+    size_type m_offset;
+    /**
+     * Length of the string in runes, or <code>npos</code> if the string
+     * extends to the end of it's storage.
+     */
+    size_type m_length;
+  };
+
+  /**
+   * Iterator which decodes runes of UTF-8 rune string as it traverses
+   * through it.
+   */
+  struct utf8_runestring::iterator : public std::iterator<
+    std::bidirectional_iterator_tag,
+    value_type,
+    difference_type,
+    const rune*,
+    value_type
+  >
+  {
+  public:
+    iterator();
+
+    value_type operator*() const;
+
+    iterator& operator++();
+
+    iterator operator++(int);
+
+    iterator& operator--();
+
+    iterator operator--(int);
+
+    inline bool operator==(const iterator& that) const
+    {
+      return m_pointer == that.m_pointer;
+    }
+
+    inline bool operator!=(const iterator& that) const
+    {
+      return m_pointer != that.m_pointer;
+    }
+
+  private:
+    const char* m_pointer;
+    friend class utf8_runestring;
+  };
+
+  std::ostream& operator<<(std::ostream&, const utf8_runestring&);
+}
+
+#endif /* !PEELO_TEXT_UTF8_RUNESTRING_HPP_GUARD */
@@ -0,0 +1,753 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <peelo/text/batch_loader.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(PEELO_TEXT_HAVE_IO_URING)
+# include <linux/io_uring.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <sys/uio.h>
+#endif
+
+namespace peelo
+{
+  namespace
+  {
+    /**
+     * Opens file in given path for reading and finds out it's size.
+     */
+    int open_file(const std::string& path, batch_loader::size_type& size)
+    {
+      const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat st;
+
+      if (fd < 0)
+      {
+        return -errno;
+      }
+      else if (::fstat(fd, &st) < 0)
+      {
+        const int error = errno;
+
+        ::close(fd);
+
+        return -error;
+      }
+      size = st.st_size > 0 ? static_cast<batch_loader::size_type>(st.st_size)
+                            : 0;
+
+      return fd;
+    }
+
+    /**
+     * Read buffer which keeps it's capacity between files, unless the
+     * capacity grows beyond given limit.
+     */
+    void release_buffer(std::vector<char>& buffer,
+                        batch_loader::size_type limit)
+    {
+      if (buffer.capacity() > limit)
+      {
+        std::vector<char>().swap(buffer);
+      }
+    }
+
+#if defined(PEELO_TEXT_HAVE_IO_URING)
+    /**
+     * Minimal io_uring submission and completion queue pair, driven with raw
+     * system calls so that no external library is required.
+     */
+    class uring
+    {
+    public:
+      explicit uring(unsigned entries)
+        : m_fd(-1)
+        , m_sq_ring(MAP_FAILED)
+        , m_cq_ring(MAP_FAILED)
+        , m_sqes(MAP_FAILED)
+      {
+        io_uring_params params;
+
+        std::memset(&params, 0, sizeof(params));
+        m_fd = static_cast<int>(
+          ::syscall(__NR_io_uring_setup, entries, &params)
+        );
+        if (m_fd < 0)
+        {
+          return;
+        }
+        m_sq_ring_size = params.sq_off.array
+          + params.sq_entries * sizeof(unsigned);
+        m_cq_ring_size = params.cq_off.cqes
+          + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+          m_sq_ring_size = m_cq_ring_size = std::max(
+            m_sq_ring_size,
+            m_cq_ring_size
+          );
+        }
+        m_sq_ring = ::mmap(
+          nullptr,
+          m_sq_ring_size,
+          PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_POPULATE,
+          m_fd,
+          IORING_OFF_SQ_RING
+        );
+        if (m_sq_ring == MAP_FAILED)
+        {
+          close();
+          return;
+        }
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+          m_cq_ring = m_sq_ring;
+        } else {
+          m_cq_ring = ::mmap(
+            nullptr,
+            m_cq_ring_size,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE,
+            m_fd,
+            IORING_OFF_CQ_RING
+          );
+          if (m_cq_ring == MAP_FAILED)
+          {
+            close();
+            return;
+          }
+        }
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = ::mmap(
+          nullptr,
+          m_sqes_size,
+          PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_POPULATE,
+          m_fd,
+          IORING_OFF_SQES
+        );
+        if (m_sqes == MAP_FAILED)
+        {
+          close();
+          return;
+        }
+
+        char* sq = static_cast<char*>(m_sq_ring);
+        char* cq = static_cast<char*>(m_cq_ring);
+
+        m_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        m_sq_mask = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        m_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        m_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        m_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        m_cq_mask = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+        m_pending = 0;
+      }
+
+      uring(const uring&) = delete;
+
+      uring& operator=(const uring&) = delete;
+
+      ~uring()
+      {
+        close();
+      }
+
+      inline bool ok() const
+      {
+        return m_fd >= 0;
+      }
+
+      /**
+       * Queues vectored read of given file. The I/O vector must stay valid
+       * until the read has been submitted.
+       */
+      void read(int fd, const iovec* vec, std::uint64_t offset,
+                std::uint64_t user_data)
+      {
+        const unsigned tail = *m_sq_tail;
+        const unsigned index = tail & m_sq_mask;
+        io_uring_sqe* sqe = static_cast<io_uring_sqe*>(m_sqes) + index;
+
+        std::memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READV;
+        sqe->fd = fd;
+        sqe->addr = reinterpret_cast<std::uint64_t>(vec);
+        sqe->len = 1;
+        sqe->off = offset;
+        sqe->user_data = user_data;
+        m_sq_array[index] = index;
+        __atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++m_pending;
+      }
+
+      /**
+       * Submits queued reads and waits until at least given number of
+       * completions are available.
+       */
+      int submit(unsigned wait)
+      {
+        for (;;)
+        {
+          const long result = ::syscall(
+            __NR_io_uring_enter,
+            m_fd,
+            m_pending,
+            wait,
+            wait ? IORING_ENTER_GETEVENTS : 0,
+            nullptr,
+            0
+          );
+
+          if (result >= 0)
+          {
+            m_pending -= static_cast<unsigned>(result);
+
+            return 0;
+          }
+          else if (errno != EINTR)
+          {
+            return -errno;
+          }
+        }
+      }
+
+      /**
+       * Removes next completion from the completion queue. Returns
+       * <code>false</code> if the queue is empty.
+       */
+      bool complete(std::uint64_t& user_data, int& result)
+      {
+        const unsigned head = *m_cq_head;
+        const io_uring_cqe* cqe;
+
+        if (head == __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE))
+        {
+          return false;
+        }
+        cqe = m_cqes + (head & m_cq_mask);
+        user_data = cqe->user_data;
+        result = cqe->res;
+        __atomic_store_n(m_cq_head, head + 1, __ATOMIC_RELEASE);
+
+        return true;
+      }
+
+    private:
+      void close()
+      {
+        if (m_sqes != MAP_FAILED)
+        {
+          ::munmap(m_sqes, m_sqes_size);
+        }
+        if (m_cq_ring != MAP_FAILED && m_cq_ring != m_sq_ring)
+        {
+          ::munmap(m_cq_ring, m_cq_ring_size);
+        }
+        if (m_sq_ring != MAP_FAILED)
+        {
+          ::munmap(m_sq_ring, m_sq_ring_size);
+        }
+        if (m_fd >= 0)
+        {
+          ::close(m_fd);
+        }
+        m_fd = -1;
+        m_sq_ring = m_cq_ring = m_sqes = MAP_FAILED;
+      }
+
+      int m_fd;
+      void* m_sq_ring;
+      void* m_cq_ring;
+      void* m_sqes;
+      std::size_t m_sq_ring_size;
+      std::size_t m_cq_ring_size;
+      std::size_t m_sqes_size;
+      unsigned* m_sq_tail;
+      unsigned m_sq_mask;
+      unsigned* m_sq_array;
+      unsigned* m_cq_head;
+      unsigned* m_cq_tail;
+      unsigned m_cq_mask;
+      io_uring_cqe* m_cqes;
+      unsigned m_pending;
+    };
+
+    /**
+     * State of a single read slot in the submission loop. The file
+     * descriptor is negative when the slot has no read in flight.
+     */
+    struct uring_request
+    {
+      batch_loader::size_type index;
+      int fd;
+      batch_loader::size_type size;
+      batch_loader::size_type done;
+      std::vector<char> buffer;
+      iovec vec;
+    };
+
+    /**
+     * Waits until reads which are still in flight have completed and closes
+     * their files, so that the read buffers can be destroyed. Used when the
+     * submission loop is left with an exception. If the ring itself fails,
+     * buffers of the remaining reads are leaked instead, since the kernel
+     * might still write into them.
+     */
+    void drain_uring(uring& ring,
+                     std::vector<uring_request>& requests,
+                     batch_loader::size_type in_flight)
+    {
+      std::uint64_t slot;
+      int result;
+
+      while (in_flight && ring.submit(1) >= 0)
+      {
+        while (ring.complete(slot, result))
+        {
+          ::close(requests[slot].fd);
+          requests[slot].fd = -1;
+          --in_flight;
+        }
+      }
+      for (auto& request : requests)
+      {
+        if (request.fd >= 0)
+        {
+          ::close(request.fd);
+          new std::vector<char>(std::move(request.buffer));
+        }
+      }
+    }
+
+    void load_with_uring(uring& ring,
+                         const std::vector<std::string>& paths,
+                         const batch_loader::callback_type& callback,
+                         unsigned queue_depth,
+                         batch_loader::size_type memory_budget)
+    {
+      const batch_loader::size_type buffer_limit = memory_budget / queue_depth;
+      std::vector<uring_request> requests(queue_depth);
+      std::vector<unsigned> free_slots;
+      batch_loader::size_type next = 0;
+      batch_loader::size_type in_flight = 0;
+      batch_loader::size_type bytes_in_flight = 0;
+      int pending_fd = -1;
+      batch_loader::size_type pending_size = 0;
+
+      for (unsigned i = queue_depth; i > 0; --i)
+      {
+        requests[i - 1].fd = -1;
+        free_slots.push_back(i - 1);
+      }
+      try
+      {
+        while (next < paths.size() || in_flight)
+        {
+          // Queue reads until the queue depth or memory budget is reached.
+          while (next < paths.size() && !free_slots.empty())
+          {
+            int fd = pending_fd;
+            batch_loader::size_type size = pending_size;
+            unsigned slot;
+
+            if (fd < 0 && (fd = open_file(paths[next], size)) < 0)
+            {
+              callback(
+                next++,
+                runestring(),
+                std::error_code(-fd, std::system_category())
+              );
+              continue;
+            }
+            // The file is held as pending until it's read has been queued, so
+            // that it's closed if anything below throws.
+            pending_fd = fd;
+            pending_size = size;
+            if (!size)
+            {
+              ::close(fd);
+              pending_fd = -1;
+              callback(next++, runestring(), std::error_code());
+              continue;
+            }
+            else if (in_flight && bytes_in_flight + size > memory_budget)
+            {
+              break;
+            }
+            slot = free_slots.back();
+
+            uring_request& request = requests[slot];
+
+            request.buffer.resize(size);
+            free_slots.pop_back();
+            request.index = next++;
+            request.fd = fd;
+            request.size = size;
+            request.done = 0;
+            request.vec.iov_base = request.buffer.data();
+            request.vec.iov_len = size;
+            ring.read(fd, &request.vec, 0, slot);
+            pending_fd = -1;
+            bytes_in_flight += size;
+            ++in_flight;
+          }
+          if (!in_flight)
+          {
+            continue;
+          }
+
+          const int error = ring.submit(1);
+          std::uint64_t slot;
+          int result;
+
+          if (error < 0)
+          {
+            throw std::system_error(-error, std::system_category());
+          }
+          while (ring.complete(slot, result))
+          {
+            uring_request& request = requests[slot];
+
+            if (result > 0 && request.done + result < request.size)
+            {
+              // Short read, queue read of the remaining bytes.
+              request.done += result;
+              request.vec.iov_base = request.buffer.data() + request.done;
+              request.vec.iov_len = request.size - request.done;
+              ring.read(request.fd, &request.vec, request.done, slot);
+              continue;
+            }
+            ::close(request.fd);
+            request.fd = -1;
+            --in_flight;
+            bytes_in_flight -= request.size;
+            if (result < 0)
+            {
+              callback(
+                request.index,
+                runestring(),
+                std::error_code(-result, std::system_category())
+              );
+            } else {
+              // A zero sized read means that the file was truncated after it's
+              // size was checked.
+              request.done += result;
+              callback(
+                request.index,
+                runestring(request.buffer.data(), request.done),
+                std::error_code()
+              );
+            }
+            release_buffer(request.buffer, buffer_limit);
+            free_slots.push_back(static_cast<unsigned>(slot));
+          }
+        }
+      }
+      catch (...)
+      {
+        drain_uring(ring, requests, in_flight);
+        if (pending_fd >= 0)
+        {
+          ::close(pending_fd);
+        }
+        throw;
+      }
+    }
+
+    bool io_uring_available()
+    {
+      static const bool available = uring(1).ok();
+
+      return available;
+    }
+#endif
+
+    /**
+     * Reads whole contents of given file descriptor with pread() into given
+     * buffer. Returns zero or negated error code.
+     */
+    int read_file(int fd,
+                  batch_loader::size_type size,
+                  std::vector<char>& buffer)
+    {
+      batch_loader::size_type done = 0;
+
+      buffer.resize(size);
+      while (done < size)
+      {
+        const ssize_t result = ::pread(
+          fd,
+          buffer.data() + done,
+          size - done,
+          static_cast<off_t>(done)
+        );
+
+        if (result < 0)
+        {
+          if (errno == EINTR)
+          {
+            continue;
+          }
+
+          return -errno;
+        }
+        else if (!result)
+        {
+          break;
+        }
+        done += static_cast<batch_loader::size_type>(result);
+      }
+      buffer.resize(done);
+
+      return 0;
+    }
+
+    void load_with_threads(const std::vector<std::string>& paths,
+                           const batch_loader::callback_type& callback,
+                           unsigned queue_depth,
+                           batch_loader::size_type memory_budget)
+    {
+      const unsigned threads = std::min<std::size_t>(
+        std::min(
+          queue_depth,
+          std::max(std::thread::hardware_concurrency(), 1u)
+        ),
+        paths.size()
+      );
+      const batch_loader::size_type buffer_limit = memory_budget / threads;
+      std::atomic<batch_loader::size_type> next(0);
+      std::mutex mutex;
+      std::condition_variable budget_available;
+      batch_loader::size_type bytes_in_flight = 0;
+      std::vector<std::thread> workers;
+      std::exception_ptr failure;
+      auto work = [&]()
+      {
+        std::vector<char> buffer;
+
+        for (;;)
+        {
+          const batch_loader::size_type index = next++;
+          batch_loader::size_type size = 0;
+          int fd;
+          int error;
+
+          if (index >= paths.size())
+          {
+            return;
+          }
+          if ((fd = open_file(paths[index], size)) < 0)
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            if (failure)
+            {
+              return;
+            }
+            callback(
+              index,
+              runestring(),
+              std::error_code(-fd, std::system_category())
+            );
+            continue;
+          }
+          {
+            std::unique_lock<std::mutex> lock(mutex);
+
+            while (!failure
+                   && bytes_in_flight
+                   && bytes_in_flight + size > memory_budget)
+            {
+              budget_available.wait(lock);
+            }
+            if (failure)
+            {
+              ::close(fd);
+              return;
+            }
+            bytes_in_flight += size;
+          }
+          error = read_file(fd, size, buffer);
+          ::close(fd);
+
+          const runestring result = error
+            ? runestring()
+            : runestring(buffer.data(), buffer.size());
+
+          release_buffer(buffer, buffer_limit);
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            bytes_in_flight -= size;
+            budget_available.notify_all();
+            if (failure)
+            {
+              return;
+            }
+            callback(
+              index,
+              result,
+              std::error_code(-error, std::system_category())
+            );
+          }
+        }
+      };
+      // Exceptions thrown by the callback, or by anything else, must not
+      // escape thread functions. The first one stops the other threads and
+      // is rethrown once all of them have been joined.
+      auto guarded_work = [&]()
+      {
+        try
+        {
+          work();
+        }
+        catch (...)
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+
+          if (!failure)
+          {
+            failure = std::current_exception();
+          }
+          next = paths.size();
+          budget_available.notify_all();
+        }
+      };
+
+      try
+      {
+        for (unsigned i = 1; i < threads; ++i)
+        {
+          workers.push_back(std::thread(guarded_work));
+        }
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        failure = std::current_exception();
+        next = paths.size();
+      }
+      guarded_work();
+      for (auto& worker : workers)
+      {
+        worker.join();
+      }
+      if (failure)
+      {
+        std::rethrow_exception(failure);
+      }
+    }
+  }
+
+  batch_loader::batch_loader(unsigned queue_depth, size_type memory_budget)
+    : m_queue_depth(std::max(queue_depth, 1u))
+    , m_memory_budget(memory_budget)
+    , m_io_uring_enabled(true) {}
+
+  bool batch_loader::uses_io_uring() const
+  {
+#if defined(PEELO_TEXT_HAVE_IO_URING)
+    return m_io_uring_enabled && io_uring_available();
+#else
+    return false;
+#endif
+  }
+
+  void batch_loader::load(const std::vector<std::string>& paths,
+                          const callback_type& callback) const
+  {
+    if (paths.empty())
+    {
+      return;
+    }
+#if defined(PEELO_TEXT_HAVE_IO_URING)
+    if (uses_io_uring())
+    {
+      uring ring(m_queue_depth);
+
+      if (ring.ok())
+      {
+        load_with_uring(
+          ring,
+          paths,
+          callback,
+          m_queue_depth,
+          m_memory_budget
+        );
+        return;
+      }
+    }
+#endif
+    load_with_threads(paths, callback, m_queue_depth, m_memory_budget);
+  }
+
+  std::vector<runestring> batch_loader::load(
+    const std::vector<std::string>& paths
+  ) const
+  {
+    std::vector<runestring> result(paths.size());
+    std::error_code error;
+    size_type error_index = 0;
+
+    load(paths, [&](size_type index,
+                    const runestring& str,
+                    const std::error_code& e)
+    {
+      if (e)
+      {
+        if (!error)
+        {
+          error = e;
+          error_index = index;
+        }
+      } else {
+        result[index] = str;
+      }
+    });
+    if (error)
+    {
+      throw std::system_error(error, paths[error_index]);
+    }
+
+    return result;
+  }
+}
@@ -0,0 +1,259 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <peelo/text/batch_writer.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <system_error>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace peelo
+{
+  batch_writer::batch_writer(size_type segment_size, size_type max_segments)
+    : m_segment_size(std::max<size_type>(segment_size, 4))
+    , m_max_segments(std::min<size_type>(
+        std::max<size_type>(max_segments, 1),
+        IOV_MAX
+      ))
+    , m_segment(0)
+    , m_used(0)
+    , m_fd(-1)
+    , m_positional(false)
+    , m_offset(0) {}
+
+  batch_writer::size_type batch_writer::write(
+    int fd,
+    const std::vector<runestring>& items,
+    const runestring& separator,
+    const runestring& terminator,
+    std::vector<size_type>* written
+  )
+  {
+    m_fd = fd;
+    m_positional = false;
+    m_offset = 0;
+
+    return write_items(items, separator, terminator, written);
+  }
+
+  batch_writer::size_type batch_writer::write_at(
+    int fd,
+    size_type offset,
+    const std::vector<runestring>& items,
+    const runestring& separator,
+    const runestring& terminator,
+    std::vector<size_type>* written
+  )
+  {
+    m_fd = fd;
+    m_positional = true;
+    m_offset = offset;
+
+    return write_items(items, separator, terminator, written);
+  }
+
+  batch_writer::size_type batch_writer::write_items(
+    const std::vector<runestring>& items,
+    const runestring& separator,
+    const runestring& terminator,
+    std::vector<size_type>* written
+  )
+  {
+    const std::string encoded_separator = separator.utf8();
+    const std::string encoded_terminator = terminator.utf8();
+    size_type total = 0;
+
+    if (written)
+    {
+      written->clear();
+      written->reserve(items.size());
+    }
+    // Segments are left shrunk if previous batch failed to be written.
+    for (auto& segment : m_segments)
+    {
+      segment.resize(m_segment_size);
+    }
+    m_segment = 0;
+    m_used = 0;
+    for (std::size_t i = 0; i < items.size(); ++i)
+    {
+      size_type size = 0;
+
+      if (i > 0)
+      {
+        size += append(encoded_separator);
+      }
+      size += append(items[i]);
+      size += append(encoded_terminator);
+      if (written)
+      {
+        written->push_back(size);
+      }
+      total += size;
+    }
+    flush();
+
+    return total;
+  }
+
+  batch_writer::size_type batch_writer::append(const std::string& data)
+  {
+    size_type done = 0;
+
+    while (done < data.size())
+    {
+      size_type count;
+
+      if (m_used == m_segment_size)
+      {
+        if (++m_segment == m_max_segments)
+        {
+          flush();
+        }
+        m_used = 0;
+      }
+      if (m_segment == m_segments.size())
+      {
+        m_segments.push_back(std::vector<char>(m_segment_size));
+      }
+      count = std::min(data.size() - done, m_segment_size - m_used);
+      std::copy(
+        data.data() + done,
+        data.data() + done + count,
+        m_segments[m_segment].data() + m_used
+      );
+      m_used += count;
+      done += count;
+    }
+
+    return done;
+  }
+
+  batch_writer::size_type batch_writer::append(const runestring& str)
+  {
+    runestring::size_type pos = 0;
+    size_type done = 0;
+
+    while (pos < str.length())
+    {
+      runestring::encode_result result;
+
+      if (m_segment == m_segments.size())
+      {
+        m_segments.push_back(std::vector<char>(m_segment_size));
+      }
+      result = str.encode_utf8_bounded(
+        pos,
+        m_segment_size - m_used,
+        m_segments[m_segment].data() + m_used
+      );
+      pos += result.runes;
+      m_used += result.bytes;
+      done += result.bytes;
+      if (pos < str.length())
+      {
+        // The next rune does not fit into the segment. Any space left at the
+        // end of the segment is simply not written.
+        m_segments[m_segment].resize(m_used);
+        if (++m_segment == m_max_segments)
+        {
+          flush();
+        }
+        m_used = 0;
+      }
+    }
+
+    return done;
+  }
+
+  void batch_writer::flush()
+  {
+    std::vector<iovec> vectors;
+    std::size_t first = 0;
+
+    // Current segment is only partially filled.
+    if (m_segment < m_max_segments && m_used)
+    {
+      m_segments[m_segment].resize(m_used);
+      ++m_segment;
+    }
+    for (size_type i = 0; i < m_segment; ++i)
+    {
+      iovec vec;
+
+      vec.iov_base = m_segments[i].data();
+      vec.iov_len = m_segments[i].size();
+      vectors.push_back(vec);
+    }
+    while (first < vectors.size())
+    {
+      const ssize_t result = m_positional
+        ? ::pwritev(
+            m_fd,
+            vectors.data() + first,
+            static_cast<int>(vectors.size() - first),
+            static_cast<off_t>(m_offset)
+          )
+        : ::writev(
+            m_fd,
+            vectors.data() + first,
+            static_cast<int>(vectors.size() - first)
+          );
+      size_type remaining;
+
+      if (result < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        throw std::system_error(errno, std::system_category());
+      }
+      remaining = static_cast<size_type>(result);
+      m_offset += remaining;
+      // Skip over everything which was written by partial write.
+      while (first < vectors.size() && remaining >= vectors[first].iov_len)
+      {
+        remaining -= vectors[first++].iov_len;
+      }
+      if (first < vectors.size())
+      {
+        vectors[first].iov_base = static_cast<char*>(
+          vectors[first].iov_base
+        ) + remaining;
+        vectors[first].iov_len -= remaining;
+      }
+    }
+    for (size_type i = 0; i < m_segment; ++i)
+    {
+      m_segments[i].resize(m_segment_size);
+    }
+    m_segment = 0;
+    m_used = 0;
+  }
+}
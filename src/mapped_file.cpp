@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <peelo/text/mapped_file.hpp>
+#include <cerrno>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace peelo
+{
+  mapped_file::mapped_file()
+    : m_data(nullptr)
+    , m_size(0) {}
+
+  mapped_file::mapped_file(const std::string& path)
+    : m_data(nullptr)
+    , m_size(0)
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    void* data;
+
+    if (fd < 0)
+    {
+      throw std::system_error(errno, std::system_category(), path);
+    }
+    if (::fstat(fd, &st) < 0)
+    {
+      const int error = errno;
+
+      ::close(fd);
+
+      throw std::system_error(error, std::system_category(), path);
+    }
+    if (st.st_size <= 0)
+    {
+      ::close(fd);
+
+      return;
+    }
+    data = ::mmap(
+      nullptr,
+      static_cast<size_type>(st.st_size),
+      PROT_READ,
+      MAP_PRIVATE,
+      fd,
+      0
+    );
+    if (data == MAP_FAILED)
+    {
+      const int error = errno;
+
+      ::close(fd);
+
+      throw std::system_error(error, std::system_category(), path);
+    }
+    // The mapping keeps its own reference to the file.
+    ::close(fd);
+    ::madvise(data, static_cast<size_type>(st.st_size), MADV_SEQUENTIAL);
+    m_data = static_cast<const char*>(data);
+    m_size = static_cast<size_type>(st.st_size);
+  }
+
+  mapped_file::~mapped_file()
+  {
+    close();
+  }
+
+  void mapped_file::release(size_type offset, size_type count)
+  {
+    static const size_type page_size = ::sysconf(_SC_PAGESIZE);
+    size_type begin;
+    size_type end;
+
+    if (!m_data || offset >= m_size)
+    {
+      return;
+    }
+    else if (count > m_size - offset)
+    {
+      count = m_size - offset;
+    }
+    begin = offset / page_size * page_size;
+    end = (offset + count) / page_size * page_size;
+    if (offset + count == m_size)
+    {
+      end = offset + count;
+    }
+    if (begin < end)
+    {
+      ::madvise(
+        const_cast<char*>(m_data + begin),
+        end - begin,
+        MADV_DONTNEED
+      );
+    }
+  }
+
+  void mapped_file::close()
+  {
+    if (m_data)
+    {
+      ::munmap(const_cast<char*>(m_data), m_size);
+      m_data = nullptr;
+      m_size = 0;
+    }
+  }
+}
@@ -0,0 +1,161 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <peelo/text/memory_resource.hpp>
+#include <algorithm>
+#include <cstdint>
+
+namespace peelo
+{
+  memory_resource::~memory_resource() {}
+
+  namespace
+  {
+    class new_delete_memory_resource : public memory_resource
+    {
+    protected:
+      void* do_allocate(std::size_t bytes, std::size_t)
+      {
+        return ::operator new(bytes);
+      }
+
+      void do_deallocate(void* p, std::size_t, std::size_t)
+      {
+        ::operator delete(p);
+      }
+
+      bool do_is_equal(const memory_resource& that) const noexcept
+      {
+        return this == &that;
+      }
+    };
+  }
+
+  /** Default resource of the calling thread, or null for new/delete. */
+  static thread_local memory_resource* default_resource = nullptr;
+
+  memory_resource* new_delete_resource() noexcept
+  {
+    static new_delete_memory_resource resource;
+
+    return &resource;
+  }
+
+  memory_resource* get_default_resource() noexcept
+  {
+    return default_resource ? default_resource : new_delete_resource();
+  }
+
+  memory_resource* set_default_resource(memory_resource* resource) noexcept
+  {
+    memory_resource* previous = get_default_resource();
+
+    default_resource = resource;
+
+    return previous;
+  }
+
+  /**
+   * Header of chunk allocated from the upstream resource. The memory handed
+   * out from the chunk follows the header.
+   */
+  struct monotonic_buffer_resource::chunk
+  {
+    chunk* next;
+    std::size_t size;
+  };
+
+  monotonic_buffer_resource::monotonic_buffer_resource(
+    std::size_t initial_size,
+    memory_resource* upstream
+  )
+    : m_upstream(upstream)
+    , m_chunks(nullptr)
+    , m_next_size(std::max<std::size_t>(initial_size, 64))
+    , m_current(nullptr)
+    , m_available(0) {}
+
+  monotonic_buffer_resource::~monotonic_buffer_resource()
+  {
+    release();
+  }
+
+  void monotonic_buffer_resource::release()
+  {
+    while (m_chunks)
+    {
+      chunk* next = m_chunks->next;
+
+      m_upstream->deallocate(m_chunks, m_chunks->size, alignof(chunk));
+      m_chunks = next;
+    }
+    m_current = nullptr;
+    m_available = 0;
+  }
+
+  void* monotonic_buffer_resource::do_allocate(std::size_t bytes,
+                                               std::size_t alignment)
+  {
+    std::size_t padding = -reinterpret_cast<std::uintptr_t>(m_current)
+      & (alignment - 1);
+    char* result;
+
+    if (!m_current || padding + bytes > m_available)
+    {
+      const std::size_t size = std::max(
+        m_next_size,
+        sizeof(chunk) + alignment + bytes
+      );
+      chunk* new_chunk = static_cast<chunk*>(
+        m_upstream->allocate(size, alignof(chunk))
+      );
+
+      new_chunk->next = m_chunks;
+      new_chunk->size = size;
+      m_chunks = new_chunk;
+      m_current = reinterpret_cast<char*>(new_chunk + 1);
+      m_available = size - sizeof(chunk);
+      m_next_size = size * 2;
+      padding = -reinterpret_cast<std::uintptr_t>(m_current)
+        & (alignment - 1);
+    }
+    result = m_current + padding;
+    m_current = result + bytes;
+    m_available -= padding + bytes;
+
+    return result;
+  }
+
+  void monotonic_buffer_resource::do_deallocate(void*,
+                                                std::size_t,
+                                                std::size_t) {}
+
+  bool monotonic_buffer_resource::do_is_equal(
+    const memory_resource& that
+  ) const noexcept
+  {
+    return this == &that;
+  }
+}
@@ -47,9 +47,6 @@ namespace peelo
     }
   }
 
-  rune::rune(const rune& that)
-    : m_code(that.m_code) {}
-
   rune& rune::assign(const rune& that)
   {
     m_code = that.m_code;
@@ -0,0 +1,481 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <peelo/text/runerope.hpp>
+#include <algorithm>
+#include <stdexcept>
+
+namespace peelo
+{
+  void copy_runes(const unsigned char*,
+                  unsigned,
+                  runestring::size_type,
+                  unsigned char*,
+                  unsigned);
+
+  /**
+   * Maximum number of runes in a leaf. Adjacent leaves shorter than this
+   * are merged when the tree is modified, so that repeated small edits
+   * don't fragment the tree.
+   */
+  static const runestring::size_type max_leaf_length = 1024;
+
+  struct runerope::node
+  {
+    /** Contents of leaf node. Empty in inner nodes. */
+    runestring text;
+    node_pointer left;
+    node_pointer right;
+    /** Number of runes in the subtree. */
+    size_type length;
+    /** Number of line feeds in the subtree. */
+    size_type newlines;
+    /** Height of the subtree. Leaves have height of zero. */
+    unsigned height;
+    /** Base 2 logarithm of the widest storage width in the subtree. */
+    unsigned shift;
+  };
+
+  static runestring::size_type count_newlines(const runestring& text,
+                                              runestring::size_type length)
+  {
+    runestring::size_type count = 0;
+
+    for (runestring::size_type pos = text.find(rune('\n'));
+         pos < length;
+         pos = text.find(rune('\n'), pos + 1))
+    {
+      ++count;
+    }
+
+    return count;
+  }
+
+  runerope::runerope() {}
+
+  runerope::runerope(const runestring& str)
+    : m_root(build(str)) {}
+
+  runerope::runerope(const char* input)
+    : m_root(build(runestring(input))) {}
+
+  runerope::runerope(const node_pointer& root)
+    : m_root(root) {}
+
+  runerope::node_pointer runerope::make_leaf(const runestring& text)
+  {
+    std::shared_ptr<node> result;
+
+    if (text.empty())
+    {
+      return result;
+    }
+    result = std::make_shared<node>();
+    result->text = text;
+    result->length = text.length();
+    result->newlines = count_newlines(text, text.length());
+    result->height = 0;
+    result->shift = text.shift();
+
+    return result;
+  }
+
+  runerope::node_pointer runerope::make_node(const node_pointer& left,
+                                             const node_pointer& right)
+  {
+    std::shared_ptr<node> result = std::make_shared<node>();
+
+    result->left = left;
+    result->right = right;
+    result->length = left->length + right->length;
+    result->newlines = left->newlines + right->newlines;
+    result->height = std::max(left->height, right->height) + 1;
+    result->shift = std::max(left->shift, right->shift);
+
+    return result;
+  }
+
+  runerope::node_pointer runerope::build(const runestring& text)
+  {
+    const size_type length = text.length();
+    const size_type leaves = (length + max_leaf_length - 1) / max_leaf_length;
+    size_type middle;
+
+    if (leaves <= 1)
+    {
+      return make_leaf(text);
+    }
+    middle = (leaves / 2) * max_leaf_length;
+
+    return make_node(
+      build(text.substr(0, middle)),
+      build(text.substr(middle))
+    );
+  }
+
+  runerope::node_pointer runerope::balance(const node_pointer& left,
+                                           const node_pointer& right)
+  {
+    if (left->height > right->height + 1)
+    {
+      if (left->left->height >= left->right->height)
+      {
+        return make_node(left->left, make_node(left->right, right));
+      }
+
+      return make_node(
+        make_node(left->left, left->right->left),
+        make_node(left->right->right, right)
+      );
+    }
+    else if (right->height > left->height + 1)
+    {
+      if (right->right->height >= right->left->height)
+      {
+        return make_node(make_node(left, right->left), right->right);
+      }
+
+      return make_node(
+        make_node(left, right->left->left),
+        make_node(right->left->right, right->right)
+      );
+    }
+
+    return make_node(left, right);
+  }
+
+  runerope::node_pointer runerope::join(const node_pointer& left,
+                                        const node_pointer& right)
+  {
+    if (!left)
+    {
+      return right;
+    }
+    else if (!right)
+    {
+      return left;
+    }
+    else if (!left->height
+             && !right->height
+             && left->length + right->length <= max_leaf_length)
+    {
+      return make_leaf(left->text.concat(right->text));
+    }
+    else if (left->height > right->height + 1)
+    {
+      return balance(left->left, join(left->right, right));
+    }
+    else if (right->height > left->height + 1)
+    {
+      return balance(join(left, right->left), right->right);
+    }
+
+    return make_node(left, right);
+  }
+
+  std::pair<runerope::node_pointer, runerope::node_pointer> runerope::split(
+    const node_pointer& tree,
+    size_type pos
+  )
+  {
+    std::pair<node_pointer, node_pointer> result;
+
+    if (!tree || !pos)
+    {
+      result.second = tree;
+    }
+    else if (pos >= tree->length)
+    {
+      result.first = tree;
+    }
+    else if (!tree->height)
+    {
+      result.first = make_leaf(tree->text.substr(0, pos));
+      result.second = make_leaf(tree->text.substr(pos));
+    }
+    else if (pos <= tree->left->length)
+    {
+      result = split(tree->left, pos);
+      result.second = join(result.second, tree->right);
+    } else {
+      result = split(tree->right, pos - tree->left->length);
+      result.first = join(tree->left, result.first);
+    }
+
+    return result;
+  }
+
+  runerope::size_type runerope::length() const
+  {
+    return m_root ? m_root->length : 0;
+  }
+
+  runerope::size_type runerope::line_count() const
+  {
+    return (m_root ? m_root->newlines : 0) + 1;
+  }
+
+  runerope::size_type runerope::line_start(size_type line) const
+  {
+    const node* current = m_root.get();
+    size_type result = 0;
+
+    if (!line)
+    {
+      return 0;
+    }
+    else if (line >= line_count())
+    {
+      throw std::out_of_range("line number out of bounds");
+    }
+    // Look for the line feed which ends the preceding line.
+    while (current->height)
+    {
+      if (line <= current->left->newlines)
+      {
+        current = current->left.get();
+      } else {
+        line -= current->left->newlines;
+        result += current->left->length;
+        current = current->right.get();
+      }
+    }
+    for (size_type pos = current->text.find(rune('\n'));;
+         pos = current->text.find(rune('\n'), pos + 1))
+    {
+      if (!--line)
+      {
+        return result + pos + 1;
+      }
+    }
+  }
+
+  runerope::size_type runerope::line_of(size_type pos) const
+  {
+    const node* current = m_root.get();
+    size_type result = 0;
+
+    if (pos > length())
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    else if (pos == length())
+    {
+      return line_count() - 1;
+    }
+    while (current->height)
+    {
+      if (pos < current->left->length)
+      {
+        current = current->left.get();
+      } else {
+        pos -= current->left->length;
+        result += current->left->newlines;
+        current = current->right.get();
+      }
+    }
+
+    return result + count_newlines(current->text, pos);
+  }
+
+  runerope::value_type runerope::at(size_type pos) const
+  {
+    const node* current = m_root.get();
+
+    if (pos >= length())
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    while (current->height)
+    {
+      if (pos < current->left->length)
+      {
+        current = current->left.get();
+      } else {
+        pos -= current->left->length;
+        current = current->right.get();
+      }
+    }
+
+    return current->text[pos];
+  }
+
+  runerope& runerope::insert(size_type pos, const runestring& str)
+  {
+    return insert(pos, runerope(str));
+  }
+
+  runerope& runerope::insert(size_type pos, const runerope& that)
+  {
+    std::pair<node_pointer, node_pointer> parts;
+
+    if (pos > length())
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    parts = split(m_root, pos);
+    m_root = join(join(parts.first, that.m_root), parts.second);
+
+    return *this;
+  }
+
+  runerope& runerope::append(const runestring& str)
+  {
+    m_root = join(m_root, build(str));
+
+    return *this;
+  }
+
+  runerope& runerope::append(const runerope& that)
+  {
+    m_root = join(m_root, that.m_root);
+
+    return *this;
+  }
+
+  runerope& runerope::erase(size_type pos, size_type count)
+  {
+    const size_type length = this->length();
+
+    if (pos > length)
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    count = std::min(count, length - pos);
+    if (count)
+    {
+      m_root = join(
+        split(m_root, pos).first,
+        split(m_root, pos + count).second
+      );
+    }
+
+    return *this;
+  }
+
+  runerope runerope::substr(size_type pos, size_type count) const
+  {
+    const size_type length = this->length();
+
+    if (pos > length)
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    count = std::min(count, length - pos);
+
+    return runerope(split(split(m_root, pos).second, count).first);
+  }
+
+  template<class Function>
+  void runerope::for_each_leaf(const node* tree, const Function& function)
+  {
+    if (tree->height)
+    {
+      for_each_leaf(tree->left.get(), function);
+      for_each_leaf(tree->right.get(), function);
+    } else {
+      function(tree->text);
+    }
+  }
+
+  /**
+   * Encodes given rune string with UTF-8 character encoding, passing the
+   * result to given function in chunks.
+   */
+  template<class Function>
+  static void encode_chunks(const runestring& text, const Function& function)
+  {
+    char buffer[4096];
+
+    for (runestring::size_type pos = 0; pos < text.length();)
+    {
+      const runestring::encode_result result = text.encode_utf8_bounded(
+        pos,
+        sizeof(buffer),
+        buffer
+      );
+
+      function(buffer, result.bytes);
+      pos += result.runes;
+    }
+  }
+
+  runestring runerope::str() const
+  {
+    runestring result;
+
+    if (m_root)
+    {
+      const unsigned shift = m_root->shift;
+      unsigned char* runes = result.prepare(m_root->length, shift);
+
+      for_each_leaf(m_root.get(), [&](const runestring& text)
+      {
+        copy_runes(text.data(), text.shift(), text.length(), runes, shift);
+        runes += text.length() << shift;
+      });
+    }
+
+    return result;
+  }
+
+  std::string runerope::utf8() const
+  {
+    std::string result;
+    const auto append = [&](const char* data, std::size_t size)
+    {
+      result.append(data, size);
+    };
+
+    if (m_root)
+    {
+      result.reserve(m_root->length);
+      for_each_leaf(m_root.get(), [&](const runestring& text)
+      {
+        encode_chunks(text, append);
+      });
+    }
+
+    return result;
+  }
+
+  std::ostream& operator<<(std::ostream& os, const runerope& rope)
+  {
+    const auto write = [&](const char* data, std::size_t size)
+    {
+      os.write(data, static_cast<std::streamsize>(size));
+    };
+
+    if (rope.m_root)
+    {
+      runerope::for_each_leaf(rope.m_root.get(), [&](const runestring& text)
+      {
+        encode_chunks(text, write);
+      });
+    }
+
+    return os;
+  }
+}
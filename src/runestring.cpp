@@ -23,954 +23,3549 @@
  * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
  * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
+#include <peelo/text/mapped_file.hpp>
 #include <peelo/text/runestring.hpp>
 #include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <new>
 #include <stdexcept>
+#include <thread>
+
+#include <locale.h>
 
 namespace peelo
 {
   bool utf8_encode(char*, std::size_t&, rune::value_type);
+  bool utf16_encode(char*, std::size_t&, rune::value_type, bool);
   std::size_t utf8_decode_size(char);
+  std::size_t utf8_count_runes(const char*,
+                               std::size_t,
+                               std::size_t&,
+                               rune::value_type&);
+  std::size_t utf8_decode_runes(const char*, std::size_t, std::uint8_t*);
+  std::size_t utf8_decode_runes(const char*, std::size_t, std::uint16_t*);
+  std::size_t utf8_decode_runes(const char*, std::size_t, std::uint32_t*);
 
   template<class CharT, class Traits>
   static bool utf8_decode(std::basic_ios<CharT, Traits>&, rune::value_type&);
 
   const runestring::size_type runestring::npos(-1);
 
-  runestring::runestring()
-    : m_offset(0)
-    , m_length(0)
-    , m_runes(nullptr)
-    , m_counter(nullptr) {}
+  /** Fraction of buffer capacity below which substrings are copied. */
+  static std::atomic<double> substring_retention_threshold(0.0);
 
-  runestring::runestring(const runestring& that)
-    : m_offset(that.m_offset)
-    , m_length(that.m_length)
-    , m_runes(that.m_runes)
-    , m_counter(that.m_counter)
+  /**
+   * Returns code point of rune stored with any width.
+   */
+  template<class T>
+  static inline rune::value_type code_of(T c)
+  {
+    return c;
+  }
+
+  static inline rune::value_type code_of(const rune& r)
+  {
+    return r.code();
+  }
+
+  /**
+   * Calls given function with pointer to runes of given width.
+   */
+  template<class Function>
+  static typename Function::result_type visit(const unsigned char* runes,
+                                              unsigned shift,
+                                              const Function& function)
   {
-    if (m_counter)
+    switch (shift)
     {
-      ++(*m_counter);
+      case 0:
+        return function(runes);
+
+      case 1:
+        return function(reinterpret_cast<const std::uint16_t*>(runes));
+
+      default:
+        return function(reinterpret_cast<const std::uint32_t*>(runes));
     }
   }
 
-  runestring::runestring(size_type count, const_reference r)
-    : m_offset(0)
-    , m_length(count)
-    , m_runes(count ? new value_type[count] : nullptr)
-    , m_counter(count ? new size_type(1) : nullptr)
+  template<class Function, class T>
+  static typename Function::result_type visit(const T* a,
+                                              const unsigned char* b,
+                                              unsigned shift,
+                                              const Function& function)
   {
-    for (size_type i = 0; i < m_length; ++i)
+    switch (shift)
     {
-      m_runes[m_offset + i] = r;
+      case 0:
+        return function(a, b);
+
+      case 1:
+        return function(a, reinterpret_cast<const std::uint16_t*>(b));
+
+      default:
+        return function(a, reinterpret_cast<const std::uint32_t*>(b));
     }
   }
 
-  runestring::runestring(const_pointer s, size_type count)
-    : m_offset(0)
-    , m_length(count)
-    , m_runes(count ? new value_type[count] : nullptr)
-    , m_counter(count ? new size_type(1) : nullptr)
+  /**
+   * Calls given function with pointers to runes of two strings of given
+   * widths.
+   */
+  template<class Function>
+  static typename Function::result_type visit(const unsigned char* a,
+                                              unsigned a_shift,
+                                              const unsigned char* b,
+                                              unsigned b_shift,
+                                              const Function& function)
   {
-    if (count)
+    switch (a_shift)
     {
-      std::copy(s, s + count, m_runes + m_offset);
+      case 0:
+        return visit(a, b, b_shift, function);
+
+      case 1:
+        return visit(
+          reinterpret_cast<const std::uint16_t*>(a),
+          b,
+          b_shift,
+          function
+        );
+
+      default:
+        return visit(
+          reinterpret_cast<const std::uint32_t*>(a),
+          b,
+          b_shift,
+          function
+        );
     }
   }
 
-  runestring::runestring(const char* input)
-    : m_offset(0)
-    , m_length(0)
-    , m_runes(nullptr)
-    , m_counter(nullptr)
+  /**
+   * Stores code point into given index of runes stored with given width.
+   */
+  static inline void store(unsigned char* runes,
+                           unsigned shift,
+                           runestring::size_type pos,
+                           rune::value_type code)
   {
-    if (input)
+    switch (shift)
     {
-      for (const char* p = input; *p;)
-      {
-        const size_type size = utf8_decode_size(*p);
+      case 0:
+        runes[pos] = static_cast<std::uint8_t>(code);
+        break;
 
-        if (size == 0)
-        {
-          break;
-        }
-        ++m_length;
-        p += size;
-      }
-      if (m_length)
-      {
-        size_type index = 0;
+      case 1:
+        reinterpret_cast<std::uint16_t*>(runes)[pos] =
+          static_cast<std::uint16_t>(code);
+        break;
 
-        m_runes = new value_type[m_length];
-        m_counter = new size_type(1);
-        for (const char* p = input; *p;)
-        {
-          const size_type size = utf8_decode_size(*p);
-          value_type::value_type result;
-          bool is_valid = true;
+      default:
+        reinterpret_cast<std::uint32_t*>(runes)[pos] = code;
+        break;
+    }
+  }
 
-          if (size == 0)
-          {
-            break;
-          }
-          switch (size)
-          {
-            case 1:
-              result = *p;
-              break;
+  template<class Source, class Target>
+  static void copy_into(const Source* source,
+                        runestring::size_type count,
+                        Target* target)
+  {
+    for (runestring::size_type i = 0; i < count; ++i)
+    {
+      target[i] = static_cast<Target>(code_of(source[i]));
+    }
+  }
 
-            case 2:
-              result = *p & 0x1f;
-              break;
+  /**
+   * Copies runes into storage of given width, which must be large enough to
+   * hold all of them.
+   */
+  struct copy_function
+  {
+    typedef void result_type;
 
-            case 3:
-              result = *p & 0x0f;
-              break;
+    runestring::size_type count;
+    unsigned char* target;
+    unsigned shift;
 
-            case 4:
-              result = *p & 0x07;
-              break;
+    template<class Source>
+    void operator()(const Source* source) const
+    {
+      switch (shift)
+      {
+        case 0:
+          copy_into(source, count, target);
+          break;
 
-            case 5:
-              result = *p & 0x03;
-              break;
+        case 1:
+          copy_into(source, count, reinterpret_cast<std::uint16_t*>(target));
+          break;
 
-            case 6:
-              result = *p & 0x01;
-              break;
-          }
-          for (size_type i = 1; i < size; ++i)
-          {
-            if ((p[i] & 0xc0) == 0x80)
-            {
-              result = (result << 6) | (p[i] & 0x3f);
-            } else {
-              is_valid = false;
-              break;
-            }
-          }
-          if (is_valid)
-          {
-            m_runes[m_offset + index++] = result;
-            p += size;
-          } else {
-            break;
-          }
-        }
+        default:
+          copy_into(source, count, reinterpret_cast<std::uint32_t*>(target));
+          break;
       }
     }
-  }
+  };
 
-  runestring::~runestring()
+  /**
+   * Copies runes from storage of one width into storage of another.
+   */
+  void copy_runes(const unsigned char* source,
+                  unsigned source_shift,
+                  runestring::size_type count,
+                  unsigned char* target,
+                  unsigned target_shift)
   {
-    if (m_counter && !--(*m_counter))
+    if (source_shift == target_shift)
     {
-      delete[] m_runes;
-      delete m_counter;
+      std::memcpy(target, source, count << source_shift);
+    } else {
+      const copy_function function = { count, target, target_shift };
+
+      visit(source, source_shift, function);
     }
   }
 
-  bool runestring::blank() const
+  template<class Source, class Target>
+  static runestring::size_type convert_into(
+    const Source* source,
+    runestring::size_type count,
+    Target* target,
+    rune::value_type (*function)(rune::value_type)
+  )
   {
-    if (!m_length)
-    {
-      return true;
-    }
-    for (size_type i = 0; i < m_length; ++i)
+    for (runestring::size_type i = 0; i < count; ++i)
     {
-      if (!m_runes[m_offset + i].is_space())
+      const rune::value_type c = function(source[i]);
+
+      if (c > std::numeric_limits<Target>::max())
       {
-        return false;
+        return i;
       }
+      target[i] = static_cast<Target>(c);
     }
 
-    return true;
+    return count;
   }
 
-  runestring::const_reference runestring::front() const
+  /**
+   * Applies function to runes and stores the results into storage of given
+   * width. Conversion stops before the first result which does not fit into
+   * the storage, and number of runes converted is returned.
+   */
+  struct convert_function
   {
-    if (!m_length)
-    {
-      throw std::out_of_range("string is empty");
-    }
+    typedef runestring::size_type result_type;
 
-    return m_runes[m_offset];
-  }
+    runestring::size_type count;
+    unsigned char* target;
+    unsigned shift;
+    rune::value_type (*function)(rune::value_type);
 
-  runestring::const_reference runestring::back() const
-  {
-    if (!m_length)
+    template<class Source>
+    result_type operator()(const Source* source) const
     {
-      throw std::out_of_range("string is empty");
+      switch (shift)
+      {
+        case 0:
+          return convert_into(source, count, target, function);
+
+        case 1:
+          return convert_into(
+            source,
+            count,
+            reinterpret_cast<std::uint16_t*>(target),
+            function
+          );
+
+        default:
+          return convert_into(
+            source,
+            count,
+            reinterpret_cast<std::uint32_t*>(target),
+            function
+          );
+      }
     }
+  };
 
-    return m_runes[m_offset + m_length - 1];
-  }
-
-  runestring::const_reference runestring::at(size_type pos) const
+  /**
+   * Decodes UTF-8 input into runes of given width and returns number of
+   * runes decoded.
+   */
+  std::size_t decode_runes(const char* input,
+                           std::size_t size,
+                           unsigned char* output,
+                           unsigned shift)
   {
-    if (m_length && pos < m_length)
+    switch (shift)
     {
-      return m_runes[m_offset + pos];
+      case 0:
+        return utf8_decode_runes(
+          input,
+          size,
+          reinterpret_cast<std::uint8_t*>(output)
+        );
+
+      case 1:
+        return utf8_decode_runes(
+          input,
+          size,
+          reinterpret_cast<std::uint16_t*>(output)
+        );
+
+      default:
+        return utf8_decode_runes(
+          input,
+          size,
+          reinterpret_cast<std::uint32_t*>(output)
+        );
     }
+  }
 
-    throw std::out_of_range("index out of bounds");
+  static rune::value_type ascii_to_lower(rune::value_type c)
+  {
+    return c >= 'A' && c <= 'Z' ? c + 32 : c;
   }
 
-  runestring::iterator runestring::begin() const
+  static rune::value_type ascii_to_upper(rune::value_type c)
   {
-    iterator i;
+    return c >= 'a' && c <= 'z' ? c - 32 : c;
+  }
 
-    if (m_runes)
+  /**
+   * Selects case conversion function for runes below given bound. Pure ASCII
+   * input skips the Unicode case mapping tables.
+   */
+  static rune::value_type (*lower_function(rune::value_type bound))
+    (rune::value_type)
+  {
+    if (bound < 0x80)
     {
-      i.m_pointer = m_runes + m_offset;
+      return ascii_to_lower;
     }
 
-    return i;
+    return rune::to_lower;
   }
 
-  runestring::iterator runestring::end() const
+  static rune::value_type (*upper_function(rune::value_type bound))
+    (rune::value_type)
   {
-    iterator i;
-
-    if (m_runes)
+    if (bound < 0x80)
     {
-      i.m_pointer = m_runes + m_offset + m_length;
+      return ascii_to_upper;
     }
 
-    return i;
+    return rune::to_upper;
   }
 
-  runestring::reverse_iterator runestring::rbegin() const
+  runestring::runestring()
   {
-    return reverse_iterator(begin());
+    m_rep.small.header = 0;
   }
 
-  runestring::reverse_iterator runestring::rend() const
+  runestring::runestring(const runestring& that)
+    : m_rep(that.m_rep)
   {
-    return reverse_iterator(end());
+    retain();
   }
 
-  runestring& runestring::assign(const runestring& that)
+  runestring::runestring(runestring&& that) noexcept
+    : m_rep(that.m_rep)
   {
-    if (m_runes != that.m_runes)
-    {
-      if (m_counter && !--(*m_counter))
-      {
-        delete[] m_runes;
-        delete m_counter;
-      }
-      m_runes = that.m_runes;
-      if ((m_counter = that.m_counter))
-      {
-        ++(*m_counter);
-      }
-    }
-    m_offset = that.m_offset;
-    m_length = that.m_length;
-
-    return *this;
+    that.m_rep.small.header = 0;
   }
 
-  bool runestring::equals(const runestring& that) const
+  runestring::runestring(size_type count, const_reference r)
   {
-    if (m_runes == that.m_runes)
-    {
-      return m_offset == that.m_offset && m_length == that.m_length;
-    }
-    else if (m_length != that.m_length)
-    {
-      return false;
-    }
-    for (size_type i = 0; i < m_length; ++i)
-    {
-      if (m_runes[m_offset + i] != that.m_runes[that.m_offset + i])
-      {
-        return false;
-      }
-    }
-
-    return true;
-  }
+    const unsigned shift = shift_of(r.code());
+    unsigned char* runes;
 
-  bool runestring::equals_icase(const runestring& that) const
-  {
-    if (m_runes == that.m_runes)
-    {
-      return m_offset == that.m_offset && m_length == that.m_length;
-    }
-    else if (m_length != that.m_length)
+    m_rep.small.header = 0;
+    runes = prepare(count, shift);
+    for (size_type i = 0; i < count; ++i)
     {
-      return false;
-    }
-    for (size_type i = 0; i < m_length; ++i)
-    {
-      if (!m_runes[m_offset + i].equals_icase(that.m_runes[that.m_offset + i]))
-      {
-        return false;
-      }
+      store(runes, shift, i, r.code());
     }
-
-    return true;
   }
 
-  int runestring::compare(const runestring& that) const
+  runestring::runestring(const_pointer s, size_type count)
   {
-    if (m_runes != that.m_runes || m_offset != that.m_offset)
-    {
-      const size_type n = std::min(m_length, that.m_length);
-
-      for (size_type i = 0; i < n; ++i)
-      {
-        const_reference a = m_runes[m_offset + i];
-        const_reference b = that.m_runes[that.m_offset + i];
+    rune::value_type max_code = 0;
+    unsigned shift;
 
-        if (a > b)
-        {
-          return 1;
-        }
-        else if (a < b)
-        {
-          return -1;
-        }
-      }
-    }
-    if (m_length > that.m_length)
+    m_rep.small.header = 0;
+    for (size_type i = 0; i < count; ++i)
     {
-      return 1;
+      max_code = std::max(max_code, s[i].code());
     }
-    else if (m_length < that.m_length)
+    shift = shift_of(max_code);
     {
-      return -1;
-    } else {
-      return 0;
+      const copy_function copy = { count, prepare(count, shift), shift };
+
+      copy(s);
     }
   }
 
-  int runestring::compare_icase(const runestring& that) const
+  runestring::runestring(const char* input)
+    : runestring(input, input ? std::strlen(input) : 0) {}
+
+  runestring::runestring(const char* input, size_type size)
   {
-    if (m_runes != that.m_runes || m_offset != that.m_offset)
-    {
-      const size_type n = std::min(m_length, that.m_length);
+    size_type consumed;
+    size_type length;
+    rune::value_type max_code;
+
+    m_rep.small.header = 0;
+    if (!input || !size)
+    {
+      return;
+    }
+    length = utf8_count_runes(input, size, consumed, max_code);
+    decode_runes(
+      input,
+      consumed,
+      prepare(length, shift_of(max_code)),
+      shift_of(max_code)
+    );
+  }
 
-      for (size_type i = 0; i < n; ++i)
-      {
-        const value_type a = m_runes[m_offset + i].to_lower();
-        const value_type b = that.m_runes[that.m_offset + i].to_lower();
+  /**
+   * Returns end of the window of given size which begins from given offset,
+   * moved forward to the beginning of the next UTF-8 sequence.
+   */
+  static runestring::size_type window_end(const char* input,
+                                          runestring::size_type size,
+                                          runestring::size_type offset,
+                                          runestring::size_type window)
+  {
+    runestring::size_type end = std::min(offset + window, size);
 
-        if (a > b)
-        {
-          return 1;
-        }
-        else if (a < b)
-        {
-          return -1;
-        }
-      }
-    }
-    if (m_length > that.m_length)
-    {
-      return 1;
-    }
-    else if (m_length < that.m_length)
+    while (end < size && (input[end] & 0xc0) == 0x80)
     {
-      return -1;
-    } else {
-      return 0;
+      ++end;
     }
+
+    return end;
   }
 
-  runestring runestring::concat(const runestring& that) const
+  runestring runestring::from_file(const std::string& path)
   {
-    if (!m_length)
+    // Number of bytes counted or decoded before the pages are released.
+    static const size_type window = 8 * 1024 * 1024;
+    mapped_file file(path);
+    runestring result;
+    size_type consumed = 0;
+    size_type length = 0;
+    size_type offset = 0;
+    size_type index = 0;
+    rune::value_type max_code = 0;
+    unsigned shift;
+    unsigned char* runes;
+
+    if (file.empty())
     {
-      return that;
+      return result;
     }
-    else if (!that.m_length)
+    while (consumed < file.size())
     {
-      return *this;
-    } else {
-      runestring result;
-
-      result.m_length = m_length + that.m_length;
-      result.m_runes = new value_type[result.m_length];
-      result.m_counter = new size_type(1);
-      std::copy(
-        m_runes + m_offset,
-        m_runes + m_offset + m_length,
-        result.m_runes
+      const size_type end = window_end(
+        file.data(),
+        file.size(),
+        consumed,
+        window
       );
-      std::copy(
-        that.m_runes + that.m_offset,
-        that.m_runes + that.m_offset + that.m_length,
-        result.m_runes + m_length
+      size_type window_consumed;
+      rune::value_type window_max_code;
+
+      length += utf8_count_runes(
+        file.data() + consumed,
+        end - consumed,
+        window_consumed,
+        window_max_code
       );
-
-      return result;
+      max_code = std::max(max_code, window_max_code);
+      file.release(consumed, end - consumed);
+      consumed += window_consumed;
+      if (consumed < end)
+      {
+        break;
+      }
     }
-  }
-
-  runestring runestring::concat(const_reference r) const
-  {
-    runestring result;
-
-    result.m_length = m_length + 1;
-    result.m_runes = new value_type[result.m_length];
-    result.m_counter = new size_type(1);
-    if (m_length)
+    shift = shift_of(max_code);
+    runes = result.prepare(length, shift);
+    while (offset < consumed)
     {
-      std::copy(
-        m_runes + m_offset,
-        m_runes + m_offset + m_length,
-        result.m_runes
+      const size_type end = window_end(file.data(), consumed, offset, window);
+
+      index += decode_runes(
+        file.data() + offset,
+        end - offset,
+        runes + (index << shift),
+        shift
       );
+      file.release(offset, end - offset);
+      offset = end;
     }
-    result.m_runes[m_length] = r;
 
     return result;
   }
 
-  runestring runestring::trim() const
+  /**
+   * Calls given function with chunk indexes from 1 to <i>chunks</i> - 1 in
+   * threads of their own, and with chunk index 0 in the calling thread.
+   * Chunks whose threads cannot be started are processed in the calling
+   * thread instead, and the started threads are always joined before
+   * returning.
+   */
+  template<class Function>
+  static void run_chunks(runestring::size_type chunks,
+                         const Function& function)
   {
-    size_type i, j;
+    std::vector<std::thread> workers;
+    runestring::size_type started = 1;
 
-    for (i = 0; i < m_length; ++i)
+    try
     {
-      if (!m_runes[m_offset + i].is_space())
+      workers.reserve(chunks - 1);
+      for (; started < chunks; ++started)
       {
-        break;
+        workers.push_back(std::thread(function, started));
       }
     }
-    for (j = m_length; j > 0; --j)
+    catch (...) {}
+    try
     {
-      if (!m_runes[m_offset + j - 1].is_space())
+      for (runestring::size_type i = started; i < chunks; ++i)
       {
-        break;
+        function(i);
       }
+      function(0);
     }
-    if (i == 0 && j == m_length)
+    catch (...)
     {
-      return *this;
+      for (auto& worker : workers)
+      {
+        worker.join();
+      }
+      throw;
+    }
+    for (auto& worker : workers)
+    {
+      worker.join();
     }
-
-    return substr(i, j - i);
   }
 
-  runestring runestring::substr(size_type pos, size_type count) const
+  runestring runestring::decode_parallel(const char* input,
+                                         size_type size,
+                                         unsigned threads)
   {
+    // Inputs smaller than this per thread are not worth splitting.
+    static const size_type min_chunk_size = 64 * 1024;
+    std::vector<size_type> bounds;
+    std::vector<size_type> counts;
+    std::vector<size_type> consumed;
+    std::vector<rune::value_type> max_codes;
     runestring result;
+    size_type length = 0;
+    size_type chunks;
+    rune::value_type max_code = 0;
+    unsigned shift;
+    unsigned char* runes;
 
-    if (pos >= m_length)
-    {
-      return result;
-    }
-    else if (count == npos)
+    if (!threads)
     {
-      count = m_length - pos;
+      threads = std::max(std::thread::hardware_concurrency(), 1u);
     }
-    else if (count + pos > m_length)
+    chunks = std::min<size_type>(threads, size / min_chunk_size);
+    if (chunks < 2)
     {
-      count = m_length - pos;
+      return runestring(input, size);
     }
-    result.m_offset = m_offset + pos;
-    result.m_length = count;
-    result.m_runes = m_runes;
-    if ((result.m_counter = m_counter))
+
+    // Split the input at the first non-continuation byte following each
+    // chunk boundary, so that no sequence crosses two chunks.
+    bounds.resize(chunks + 1);
+    bounds[0] = 0;
+    bounds[chunks] = size;
+    for (size_type i = 1; i < chunks; ++i)
     {
-      ++(*m_counter);
-    }
+      size_type bound = std::max(size / chunks * i, bounds[i - 1]);
 
-    return result;
-  }
+      while (bound < size && (input[bound] & 0xc0) == 0x80)
+      {
+        ++bound;
+      }
+      bounds[i] = bound;
+    }
 
-  runestring runestring::to_lower() const
-  {
-    runestring result;
+    counts.resize(chunks);
+    consumed.resize(chunks);
+    max_codes.resize(chunks);
+    run_chunks(chunks, [&](size_type i)
+    {
+      counts[i] = utf8_count_runes(
+        input + bounds[i],
+        bounds[i + 1] - bounds[i],
+        consumed[i],
+        max_codes[i]
+      );
+    });
 
-    if (m_length)
+    // Turn the counts into offsets. Decoding ends at the first chunk that
+    // contains an invalid sequence, just like it does in serial decoding.
+    for (size_type i = 0; i < chunks; ++i)
     {
-      result.m_length = m_length;
-      result.m_runes = new value_type[m_length];
-      result.m_counter = new size_type(1);
-      for (size_type i = 0; i < m_length; ++i)
+      const size_type count = counts[i];
+
+      counts[i] = length;
+      length += count;
+      max_code = std::max(max_code, max_codes[i]);
+      if (consumed[i] != bounds[i + 1] - bounds[i])
       {
-        result.m_runes[i] = m_runes[m_offset + i].to_lower();
+        chunks = i + 1;
+        break;
       }
     }
+    shift = shift_of(max_code);
+    runes = result.prepare(length, shift);
+    run_chunks(chunks, [&](size_type i)
+    {
+      decode_runes(
+        input + bounds[i],
+        consumed[i],
+        runes + (counts[i] << shift),
+        shift
+      );
+    });
 
     return result;
   }
 
-  runestring runestring::to_upper() const
+  runestring::~runestring()
   {
-    runestring result;
+    release();
+  }
 
-    if (m_length)
-    {
-      result.m_length = m_length;
-      result.m_runes = new value_type[m_length];
-      result.m_counter = new size_type(1);
-      for (size_type i = 0; i < m_length; ++i)
-      {
-        result.m_runes[i] = m_runes[m_offset + i].to_upper();
-      }
-    }
+  runestring::buffer* runestring::allocate(size_type capacity, unsigned shift)
+  {
+    memory_resource* resource = get_default_resource();
+    buffer* result = ::new (resource->allocate(
+      sizeof(buffer) + (capacity << shift),
+      alignof(buffer)
+    )) buffer;
+
+    result->counter.store(1, std::memory_order_relaxed);
+    result->capacity = capacity;
+    result->length = 0;
+    result->flags.store(0, std::memory_order_relaxed);
+    result->shift = shift;
+    result->resource = resource;
+    result->hash.store(0, std::memory_order_relaxed);
 
     return result;
   }
 
-  std::string runestring::utf8() const
+  /**
+   * Increments given reference counter and returns it's previous value.
+   */
+  static runestring::size_type increment(
+    std::atomic<runestring::size_type>& counter
+  )
   {
-    std::string result;
-    char buffer[5];
-
-    for (size_type i = 0; i < m_length; ++i)
-    {
-      std::size_t size;
+#if PEELO_TEXT_ATOMIC_REFCOUNT
+    return counter.fetch_add(1, std::memory_order_relaxed);
+#else
+    const runestring::size_type previous = counter.load(
+      std::memory_order_relaxed
+    );
 
-      if (utf8_encode(buffer, size, m_runes[m_offset + i]))
-      {
-        buffer[size] = 0;
-        result += buffer;
-      }
-    }
+    counter.store(previous + 1, std::memory_order_relaxed);
 
-    return result;
+    return previous;
+#endif
   }
 
-  static std::string::size_type utf16_size(const runestring& str)
+  /**
+   * Decrements given reference counter and returns it's previous value.
+   */
+  static runestring::size_type decrement(
+    std::atomic<runestring::size_type>& counter
+  )
   {
-    const runestring::size_type length = str.length();
-    std::string::size_type size = 0;
+#if PEELO_TEXT_ATOMIC_REFCOUNT
+    return counter.fetch_sub(1, std::memory_order_acq_rel);
+#else
+    const runestring::size_type previous = counter.load(
+      std::memory_order_relaxed
+    );
 
-    for (runestring::size_type i = 0; i < length; ++i)
-    {
-      if (str[i].code() > 0xffff)
-      {
-        size += 4;
-      } else {
-        size += 2;
-      }
-    }
+    counter.store(previous - 1, std::memory_order_relaxed);
 
-    return size;
+    return previous;
+#endif
   }
 
-  std::string runestring::utf16_be() const
+  void runestring::release(buffer* storage)
   {
-    std::string result;
-
-    result.reserve(utf16_size(*this));
-    for (size_type i = 0; i < m_length; ++i)
+    if (decrement(storage->counter) == 1)
     {
-      const rune::value_type c = m_runes[m_offset + i].code();
+      memory_resource* resource = storage->resource;
+      const size_type size = sizeof(buffer)
+        + (storage->capacity << storage->shift);
 
-      if (c > 0xffff)
-      {
-        const rune::value_type plane = c >> 16;
-        const rune::value_type high = (c & 0xff00) >> 8;
+      storage->~buffer();
+      resource->deallocate(storage, size, alignof(buffer));
+    }
+  }
 
-        result += static_cast<char>((plane >> 2) & 0xd8);
-        result += static_cast<char>(((plane & 0x3) << 6) + (high >> 2));
-        result += static_cast<char>((high & 0x2) + 0xdc);
-        result += static_cast<char>(c & 0xff);
-      } else {
-        result += static_cast<char>((c & 0xff00) >> 8);
-        result += static_cast<char>(c & 0xff);
-      }
+  unsigned char* runestring::prepare(size_type length,
+                                     unsigned shift,
+                                     size_type capacity)
+  {
+    if ((length << shift) <= small_size)
+    {
+      m_rep.small.header = static_cast<std::uint32_t>(
+        (length << length_shift) | mode_small | shift
+      );
+    } else {
+      locate(allocate(std::max(length, capacity), shift), 0, length, shift);
+      storage()->length = length;
     }
 
-    return result;
+    return data();
   }
 
-  std::string runestring::utf16_le() const
+  void runestring::modified()
   {
-    std::string result;
-
-    result.reserve(utf16_size(*this));
-    for (size_type i = 0; i < m_length; ++i)
+    if (!is_small() && !is_literal())
     {
-      const rune::value_type c = m_runes[m_offset + i].code();
+      buffer* storage = this->storage();
 
-      if (c > 0xffff)
-      {
-        const rune::value_type plane = c >> 16;
-        const rune::value_type high = (c & 0xff00) >> 8;
+      storage->length = offset() + length();
+      storage->flags.store(0, std::memory_order_relaxed);
+    }
+  }
 
-        result += static_cast<char>(((plane & 0x3) << 6) + (high >> 2));
-        result += static_cast<char>((plane >> 2) & 0xd8);
-        result += static_cast<char>(c & 0xff);
-        result += static_cast<char>((high & 0x2) + 0xdc);
-      } else {
-        result += static_cast<char>(c & 0xff);
-        result += static_cast<char>((c & 0xff00) >> 8);
-      }
+  void runestring::locate(buffer* storage,
+                          size_type offset,
+                          size_type length,
+                          unsigned shift)
+  {
+    if (offset <= max_heap_offset && length < max_heap_length)
+    {
+      m_rep.heap.header = static_cast<std::uint32_t>(
+        (length << length_shift) | mode_heap | shift
+      );
+      m_rep.heap.offset = static_cast<std::uint32_t>(offset);
+      m_rep.heap.storage = storage;
+    } else {
+      large_location* location = new large_location;
+
+      location->counter.store(1, std::memory_order_relaxed);
+      location->storage = storage;
+      location->offset = offset;
+      location->length = length;
+      m_rep.large.header = static_cast<std::uint32_t>(
+        (max_heap_length << length_shift) | mode_large | shift
+      );
+      m_rep.large.location = location;
     }
+  }
 
-    return result;
+  void runestring::refer(const unsigned char* runes,
+                         size_type length,
+                         unsigned shift,
+                         rune::value_type max_code)
+  {
+    m_rep.literal.header = static_cast<std::uint32_t>(
+      (length << length_shift) | mode_literal | shift
+    );
+    m_rep.literal.max_code = max_code;
+    m_rep.literal.runes = runes;
   }
 
-  std::string runestring::utf32_be() const
+  bool runestring::is_extensible(size_type length, unsigned shift) const
   {
-    std::string result;
+    return !is_small()
+      && !is_large()
+      && shift <= this->shift()
+      && length < max_heap_length
+      && is_unique()
+      && m_rep.heap.storage->capacity - m_rep.heap.offset >= length;
+  }
 
-    result.reserve(m_length * 4);
-    for (size_type i = 0; i < m_length; ++i)
+  bool runestring::is_unique() const
+  {
+    if (is_small())
     {
-      const rune::value_type c = m_runes[m_offset + i].code();
+      return true;
+    }
+    else if (is_literal())
+    {
+      return false;
+    }
+    else if (is_large()
+             && m_rep.large.location->counter.load(
+               std::memory_order_acquire
+             ) != 1)
+    {
+      return false;
+    }
 
-      result += static_cast<char>((c & 0xff000000) >> 24);
-      result += static_cast<char>((c & 0xff0000) >> 16);
-      result += static_cast<char>((c & 0xff00) >> 8);
-      result += static_cast<char>(c & 0xff);
+    return storage()->counter.load(std::memory_order_acquire) == 1;
+  }
+
+  void runestring::retain()
+  {
+    if (is_large())
+    {
+      increment(m_rep.large.location->counter);
     }
+    else if (!is_small() && !is_literal())
+    {
+      increment(m_rep.heap.storage->counter);
+    }
+  }
 
-    return result;
+  void runestring::release()
+  {
+    if (is_large())
+    {
+      large_location* location = m_rep.large.location;
+
+      if (decrement(location->counter) == 1)
+      {
+        release(location->storage);
+        delete location;
+      }
+    }
+    else if (!is_small() && !is_literal())
+    {
+      release(m_rep.heap.storage);
+    }
   }
 
-  std::string runestring::utf32_le() const
+  struct max_code_function
   {
-    std::string result;
+    typedef rune::value_type result_type;
+
+    runestring::size_type length;
+
+    template<class T>
+    result_type operator()(const T* runes) const
+    {
+      T result = 0;
+
+      for (runestring::size_type i = 0; i < length; ++i)
+      {
+        if (runes[i] > result)
+        {
+          result = runes[i];
+        }
+      }
+
+      return result;
+    }
+  };
+
+  rune::value_type runestring::max_code_bound() const
+  {
+    buffer* storage;
+    unsigned flags;
+
+    if (is_small())
+    {
+      const max_code_function function = { length() };
 
-    result.reserve(m_length * 4);
-    for (size_type i = 0; i < m_length; ++i)
+      return visit(data(), shift(), function);
+    }
+    else if (is_literal())
+    {
+      return m_rep.literal.max_code;
+    }
+    storage = this->storage();
+    flags = storage->flags.load(std::memory_order_acquire);
+    if (!(flags & flag_valid))
     {
-      const rune::value_type c = m_runes[m_offset + i].code();
+      const max_code_function function = { storage->length };
 
-      result += static_cast<char>(c & 0xff);
-      result += static_cast<char>((c & 0xff00) >> 8);
-      result += static_cast<char>((c & 0xff0000) >> 16);
-      result += static_cast<char>((c & 0xff000000) >> 24);
+      flags = flag_valid | (visit(
+        storage->bytes(),
+        storage->shift,
+        function
+      ) << max_code_shift);
+      storage->flags.fetch_or(flags, std::memory_order_release);
     }
 
-    return result;
+    return flags >> max_code_shift;
   }
 
-  runestring::size_type runestring::find(const runestring& str,
-                                         size_type pos) const
+  rune::value_type runestring::max_code() const
   {
-    if (!str.m_length)
+    if (is_small() || is_literal() || is_whole())
     {
-      return pos;
+      return max_code_bound();
+    } else {
+      const max_code_function function = { length() };
+
+      return visit(data(), shift(), function);
     }
-    else if (str.m_length > m_length)
+  }
+
+  /**
+   * Multiplies two 64-bit integers into 128-bit result and folds the halves
+   * of the result together.
+   */
+  static inline std::uint64_t hash_mix(std::uint64_t a, std::uint64_t b)
+  {
+#if defined(__SIZEOF_INT128__)
+    const unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+
+    return static_cast<std::uint64_t>(product)
+      ^ static_cast<std::uint64_t>(product >> 64);
+#else
+    const std::uint64_t ll = (a & 0xffffffff) * (b & 0xffffffff);
+    const std::uint64_t lh = (a & 0xffffffff) * (b >> 32);
+    const std::uint64_t hl = (a >> 32) * (b & 0xffffffff);
+    const std::uint64_t hh = (a >> 32) * (b >> 32);
+    const std::uint64_t middle = (ll >> 32) + (lh & 0xffffffff)
+      + (hl & 0xffffffff);
+
+    return ((ll & 0xffffffff) | (middle << 32))
+      ^ (hh + (lh >> 32) + (hl >> 32) + (middle >> 32));
+#endif
+  }
+
+  /**
+   * Hash over code points, modeled after wyhash. Pairs of code points are
+   * widened into 64-bit words, so the hash does not depend on the storage
+   * width, and long strings are consumed twelve code points at a time by
+   * three independent multiplication chains.
+   */
+  struct hash_function
+  {
+    typedef std::size_t result_type;
+
+    static const std::uint64_t secret0 = 0xa0761d6478bd642fULL;
+    static const std::uint64_t secret1 = 0xe7037ed1a0b428dbULL;
+    static const std::uint64_t secret2 = 0x8ebc6af09c88c6e3ULL;
+    static const std::uint64_t secret3 = 0x589965cc75374cc3ULL;
+
+    runestring::size_type length;
+
+    template<class T>
+    static inline std::uint64_t word(const T* runes)
     {
-      return npos;
+      return static_cast<std::uint64_t>(runes[0])
+        | (static_cast<std::uint64_t>(runes[1]) << 32);
     }
-    for (size_type i = pos; i < m_length; ++i)
+
+    template<class T>
+    result_type operator()(const T* runes) const
     {
-      bool found = true;
+      std::uint64_t seed = secret0;
+      std::uint64_t a = 0;
+      std::uint64_t b = 0;
+      runestring::size_type i = 0;
+
+      if (length > 12)
+      {
+        std::uint64_t seed1 = seed;
+        std::uint64_t seed2 = seed;
 
-      if (i + str.m_length > m_length)
+        for (; length - i > 12; i += 12)
+        {
+          seed = hash_mix(
+            word(runes + i) ^ secret1,
+            word(runes + i + 2) ^ seed
+          );
+          seed1 = hash_mix(
+            word(runes + i + 4) ^ secret2,
+            word(runes + i + 6) ^ seed1
+          );
+          seed2 = hash_mix(
+            word(runes + i + 8) ^ secret3,
+            word(runes + i + 10) ^ seed2
+          );
+        }
+        seed ^= seed1 ^ seed2;
+      }
+      for (; length - i > 4; i += 4)
       {
-        return npos;
+        seed = hash_mix(word(runes + i) ^ secret1, word(runes + i + 2) ^ seed);
       }
-      for (size_type j = 0; j < str.m_length; ++j)
+      switch (length - i)
       {
-        if (m_runes[m_offset + i + j] != str.m_runes[str.m_offset + j])
-        {
-          found = false;
+        case 4:
+          b = word(runes + i + 2);
+          a = word(runes + i);
+          break;
+
+        case 3:
+          b = runes[i + 2];
+          a = word(runes + i);
+          break;
+
+        case 2:
+          a = word(runes + i);
+          break;
+
+        case 1:
+          a = runes[i];
           break;
-        }
       }
-      if (found)
+
+      return static_cast<result_type>(hash_mix(
+        secret1 ^ length,
+        hash_mix(a ^ secret1, b ^ seed)
+      ));
+    }
+  };
+
+  std::size_t runestring::hash() const
+  {
+    const hash_function function = { length() };
+    buffer* storage;
+    std::size_t result;
+
+    if (is_small() || is_literal() || !is_whole())
+    {
+      return visit(data(), shift(), function);
+    }
+    storage = this->storage();
+    if (storage->flags.load(std::memory_order_acquire) & flag_hashed)
+    {
+      return storage->hash.load(std::memory_order_relaxed);
+    }
+    result = visit(data(), shift(), function);
+    storage->hash.store(result, std::memory_order_relaxed);
+    storage->flags.fetch_or(flag_hashed, std::memory_order_release);
+
+    return result;
+  }
+
+  bool runestring::blank() const
+  {
+    const size_type length = this->length();
+
+    for (size_type i = 0; i < length; ++i)
+    {
+      if (!(*this)[i].is_space())
       {
-        return i;
+        return false;
       }
     }
 
-    return npos;
+    return true;
   }
 
-  runestring::size_type runestring::find(const_pointer s,
-                                         size_type pos,
-                                         size_type count) const
+  runestring::value_type runestring::front() const
   {
-    if (!count)
+    if (empty())
     {
-      return pos;
+      throw std::out_of_range("string is empty");
+    }
+
+    return (*this)[0];
+  }
+
+  runestring::value_type runestring::back() const
+  {
+    if (empty())
+    {
+      throw std::out_of_range("string is empty");
     }
-    else if (count > m_length)
+
+    return (*this)[length() - 1];
+  }
+
+  runestring::value_type runestring::at(size_type pos) const
+  {
+    if (pos < length())
     {
-      return npos;
+      return (*this)[pos];
+    }
+
+    throw std::out_of_range("index out of bounds");
+  }
+
+  runestring::iterator runestring::begin() const
+  {
+    iterator i;
+
+    i.m_pointer = data();
+    i.m_shift = shift();
+
+    return i;
+  }
+
+  runestring::iterator runestring::end() const
+  {
+    iterator i;
+
+    i.m_pointer = data() + (length() << shift());
+    i.m_shift = shift();
+
+    return i;
+  }
+
+  runestring::reverse_iterator runestring::rbegin() const
+  {
+    return reverse_iterator(begin());
+  }
+
+  runestring::reverse_iterator runestring::rend() const
+  {
+    return reverse_iterator(end());
+  }
+
+  runestring& runestring::assign(const runestring& that)
+  {
+    if (this != &that)
+    {
+      release();
+      m_rep = that.m_rep;
+      retain();
+    }
+
+    return *this;
+  }
+
+  runestring& runestring::assign(runestring&& that) noexcept
+  {
+    if (this != &that)
+    {
+      release();
+      m_rep = that.m_rep;
+      that.m_rep.small.header = 0;
+    }
+
+    return *this;
+  }
+
+  struct equals_function
+  {
+    typedef bool result_type;
+
+    runestring::size_type length;
+
+    template<class A, class B>
+    bool operator()(const A* a, const B* b) const
+    {
+      return std::equal(a, a + length, b);
+    }
+  };
+
+  bool runestring::equals(const runestring& that) const
+  {
+    const size_type length = this->length();
+
+    if (length != that.length())
+    {
+      return false;
+    }
+    else if (data() == that.data())
+    {
+      return true;
     }
-    for (size_type i = pos; i < m_length; ++i)
+    else if (shift() == that.shift())
     {
-      bool found = true;
+      return !std::memcmp(data(), that.data(), length << shift());
+    } else {
+      const equals_function function = { length };
+
+      return visit(data(), shift(), that.data(), that.shift(), function);
+    }
+  }
 
-      if (i + count > m_length)
+  struct equals_icase_function
+  {
+    typedef bool result_type;
+
+    runestring::size_type length;
+    rune::value_type (*function)(rune::value_type);
+
+    template<class A, class B>
+    bool operator()(const A* a, const B* b) const
+    {
+      for (runestring::size_type i = 0; i < length; ++i)
       {
-        return npos;
+        if (a[i] != b[i] && function(a[i]) != function(b[i]))
+        {
+          return false;
+        }
       }
-      for (size_type j = 0; j < count; ++j)
+
+      return true;
+    }
+  };
+
+  bool runestring::equals_icase(const runestring& that) const
+  {
+    const size_type length = this->length();
+
+    if (length != that.length())
+    {
+      return false;
+    }
+    else if (data() == that.data())
+    {
+      return true;
+    } else {
+      const equals_icase_function function = {
+        length,
+        lower_function(std::max(max_code_bound(), that.max_code_bound()))
+      };
+
+      return visit(data(), shift(), that.data(), that.shift(), function);
+    }
+  }
+
+  struct compare_function
+  {
+    typedef int result_type;
+
+    runestring::size_type length;
+    rune::value_type (*function)(rune::value_type);
+
+    template<class A, class B>
+    int operator()(const A* a, const B* b) const
+    {
+      for (runestring::size_type i = 0; i < length; ++i)
       {
-        if (m_runes[m_offset + i + j] != s[j])
+        if (a[i] != b[i])
         {
-          found = false;
-          break;
+          const rune::value_type c1 = function ? function(a[i]) : a[i];
+          const rune::value_type c2 = function ? function(b[i]) : b[i];
+
+          if (c1 > c2)
+          {
+            return 1;
+          }
+          else if (c1 < c2)
+          {
+            return -1;
+          }
         }
       }
-      if (found)
+
+      return 0;
+    }
+  };
+
+  /**
+   * Compares two strings, optionally applying given function to each rune
+   * before the comparison.
+   */
+  static int compare_runes(const unsigned char* a,
+                           unsigned a_shift,
+                           runestring::size_type a_length,
+                           const unsigned char* b,
+                           unsigned b_shift,
+                           runestring::size_type b_length,
+                           rune::value_type (*function)(rune::value_type))
+  {
+    const compare_function compare = {
+      std::min(a_length, b_length),
+      function
+    };
+    int result = 0;
+
+    if (a != b)
+    {
+      if (!function && !a_shift && !b_shift)
       {
-        return i;
+        result = std::memcmp(a, b, compare.length);
+      } else {
+        result = visit(a, a_shift, b, b_shift, compare);
       }
     }
+    if (result > 0 || (!result && a_length > b_length))
+    {
+      return 1;
+    }
+    else if (result < 0 || (!result && a_length < b_length))
+    {
+      return -1;
+    } else {
+      return 0;
+    }
+  }
+
+  int runestring::compare(const runestring& that) const
+  {
+    return compare_runes(
+      data(),
+      shift(),
+      length(),
+      that.data(),
+      that.shift(),
+      that.length(),
+      nullptr
+    );
+  }
+
+  int runestring::compare_icase(const runestring& that) const
+  {
+    return compare_runes(
+      data(),
+      shift(),
+      length(),
+      that.data(),
+      that.shift(),
+      that.length(),
+      lower_function(std::max(max_code_bound(), that.max_code_bound()))
+    );
+  }
+
+  runestring runestring::concat(const runestring& that) const &
+  {
+    if (empty())
+    {
+      return that;
+    }
+    else if (!that)
+    {
+      return *this;
+    } else {
+      const size_type length = this->length();
+      const unsigned shift = std::max(this->shift(), that.shift());
+      runestring result;
+      unsigned char* runes = result.prepare(length + that.length(), shift);
+
+      copy_runes(data(), this->shift(), length, runes, shift);
+      copy_runes(
+        that.data(),
+        that.shift(),
+        that.length(),
+        runes + (length << shift),
+        shift
+      );
+
+      return result;
+    }
+  }
+
+  runestring runestring::concat(const_reference r) const &
+  {
+    const size_type length = this->length();
+    const unsigned shift = std::max(this->shift(), shift_of(r.code()));
+    runestring result;
+    unsigned char* runes = result.prepare(length + 1, shift);
+
+    copy_runes(data(), this->shift(), length, runes, shift);
+    store(runes, shift, length, r.code());
+
+    return result;
+  }
+
+  /**
+   * Capacity of buffer which has to grow to given length in order to hold
+   * result of concatenation.
+   */
+  static runestring::size_type grown_capacity(runestring::size_type length)
+  {
+    return length + length / 2;
+  }
+
+  runestring runestring::concat(const runestring& that) &&
+  {
+    const size_type old_length = this->length();
+    const size_type length = old_length + that.length();
+    const unsigned shift = std::max(this->shift(), that.shift());
+    runestring result;
+    unsigned char* runes;
+
+    if (!old_length)
+    {
+      return that;
+    }
+    else if (!that)
+    {
+      return std::move(*this);
+    }
+    else if (is_extensible(length, that.shift()))
+    {
+      copy_runes(
+        that.data(),
+        that.shift(),
+        that.length(),
+        data() + (old_length << shift),
+        shift
+      );
+      m_rep.heap.header = static_cast<std::uint32_t>(
+        (length << length_shift) | mode_heap | shift
+      );
+      modified();
+
+      return std::move(*this);
+    }
+    runes = result.prepare(length, shift, grown_capacity(length));
+    copy_runes(data(), this->shift(), old_length, runes, shift);
+    copy_runes(
+      that.data(),
+      that.shift(),
+      that.length(),
+      runes + (old_length << shift),
+      shift
+    );
+
+    return result;
+  }
+
+  runestring runestring::concat(const_reference r) &&
+  {
+    const size_type old_length = this->length();
+    const size_type length = old_length + 1;
+    const unsigned shift = std::max(this->shift(), shift_of(r.code()));
+    runestring result;
+    unsigned char* runes;
+
+    if (is_extensible(length, shift))
+    {
+      store(data(), shift, old_length, r.code());
+      m_rep.heap.header = static_cast<std::uint32_t>(
+        (length << length_shift) | mode_heap | shift
+      );
+      modified();
+
+      return std::move(*this);
+    }
+    runes = result.prepare(length, shift, grown_capacity(length));
+    copy_runes(data(), this->shift(), old_length, runes, shift);
+    store(runes, shift, old_length, r.code());
+
+    return result;
+  }
+
+  unsigned char* runestring::splice(size_type pos,
+                                    size_type removed,
+                                    size_type inserted,
+                                    unsigned shift)
+  {
+    const size_type old_length = this->length();
+    const size_type length = old_length - removed + inserted;
+    const size_type tail = old_length - pos - removed;
+    const unsigned old_shift = this->shift();
+    runestring result;
+    unsigned char* runes;
+
+    shift = std::max(old_shift, shift);
+    if ((length << shift) > small_size && is_extensible(length, shift))
+    {
+      runes = data();
+      std::memmove(
+        runes + ((pos + inserted) << shift),
+        runes + ((pos + removed) << shift),
+        tail << shift
+      );
+      m_rep.heap.header = static_cast<std::uint32_t>(
+        (length << length_shift) | mode_heap | shift
+      );
+      modified();
+
+      return runes + (pos << shift);
+    }
+    runes = result.prepare(
+      length,
+      shift,
+      length > old_length ? grown_capacity(length) : 0
+    );
+    copy_runes(data(), old_shift, pos, runes, shift);
+    copy_runes(
+      data() + ((pos + removed) << old_shift),
+      old_shift,
+      tail,
+      runes + ((pos + inserted) << shift),
+      shift
+    );
+    assign(std::move(result));
+
+    return data() + (pos << shift);
+  }
+
+  runestring& runestring::push_back(const_reference r)
+  {
+    unsigned char* runes = splice(length(), 0, 1, shift_of(r.code()));
+
+    store(runes, shift(), 0, r.code());
+
+    return *this;
+  }
+
+  runestring& runestring::append(const runestring& that)
+  {
+    return insert(length(), that);
+  }
+
+  runestring& runestring::insert(size_type pos, const runestring& that)
+  {
+    const size_type count = that.length();
+
+    if (pos > length())
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    else if (&that == this)
+    {
+      const runestring copy(that);
+
+      return insert(pos, copy);
+    }
+    else if (count)
+    {
+      unsigned char* runes = splice(pos, 0, count, that.shift());
+
+      copy_runes(that.data(), that.shift(), count, runes, shift());
+    }
+
+    return *this;
+  }
+
+  runestring& runestring::insert(size_type pos, const_reference r)
+  {
+    unsigned char* runes;
+
+    if (pos > length())
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    runes = splice(pos, 0, 1, shift_of(r.code()));
+    store(runes, shift(), 0, r.code());
+
+    return *this;
+  }
+
+  runestring& runestring::erase(size_type pos, size_type count)
+  {
+    const size_type length = this->length();
+
+    if (pos > length)
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    count = std::min(count, length - pos);
+    if (count)
+    {
+      splice(pos, count, 0, 0);
+    }
+
+    return *this;
+  }
+
+  runestring& runestring::set(size_type pos, const_reference r)
+  {
+    unsigned char* runes;
+
+    if (pos >= length())
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    runes = splice(pos, 1, 1, shift_of(r.code()));
+    store(runes, shift(), 0, r.code());
+
+    return *this;
+  }
+
+  runestring& runestring::resize(size_type length, const_reference r)
+  {
+    const size_type old_length = this->length();
+
+    if (length < old_length)
+    {
+      splice(length, old_length - length, 0, 0);
+    }
+    else if (length > old_length)
+    {
+      unsigned char* runes = splice(
+        old_length,
+        0,
+        length - old_length,
+        shift_of(r.code())
+      );
+
+      for (size_type i = 0; i < length - old_length; ++i)
+      {
+        store(runes, shift(), i, r.code());
+      }
+    }
+
+    return *this;
+  }
+
+  runestring runestring::operator+(const char* input) &&
+  {
+    return std::move(*this).concat(runestring(input));
+  }
+
+  runestring& runestring::replace(size_type pos,
+                                  size_type count,
+                                  const runestring& str)
+  {
+    const size_type length = this->length();
+    unsigned char* runes;
+
+    if (pos > length)
+    {
+      throw std::out_of_range("index out of bounds");
+    }
+    else if (&str == this)
+    {
+      const runestring copy(str);
+
+      return replace(pos, count, copy);
+    }
+    count = std::min(count, length - pos);
+    runes = splice(pos, count, str.length(), str.shift());
+    copy_runes(str.data(), str.shift(), str.length(), runes, shift());
+
+    return *this;
+  }
+
+  typedef std::vector<rune::value_type> needle_type;
+  typedef std::pair<runestring::size_type, runestring::size_type> match_type;
+
+  /**
+   * Locates all non-overlapping occurrences of the needles in a single left
+   * to right scan. A single needle is searched with Horspool's algorithm,
+   * using the low byte of each rune for the skip table. Several needles are
+   * matched at positions whose rune has the same low byte as the first rune
+   * of one of the needles.
+   */
+  struct find_all_function
+  {
+    typedef void result_type;
+
+    runestring::size_type length;
+    const std::vector<needle_type>* needles;
+    std::vector<match_type>* matches;
+
+    template<class T>
+    static bool matches_at(const T* haystack, const needle_type& needle)
+    {
+      for (runestring::size_type i = 0; i < needle.size(); ++i)
+      {
+        if (haystack[i] != needle[i])
+        {
+          return false;
+        }
+      }
+
+      return true;
+    }
+
+    template<class T>
+    void find_one(const T* haystack, const needle_type& needle) const
+    {
+      const runestring::size_type count = needle.size();
+      const rune::value_type last = needle[count - 1];
+      runestring::size_type skip[256];
+
+      std::fill(skip, skip + 256, count);
+      for (runestring::size_type i = 0; i + 1 < count; ++i)
+      {
+        skip[needle[i] & 0xff] = count - 1 - i;
+      }
+      for (runestring::size_type i = 0; i + count <= length;)
+      {
+        const rune::value_type c = haystack[i + count - 1];
+
+        if (c == last && matches_at(haystack + i, needle))
+        {
+          matches->push_back(match_type(i, 0));
+          i += count;
+        } else {
+          i += skip[c & 0xff];
+        }
+      }
+    }
+
+    template<class T>
+    void find_many(const T* haystack) const
+    {
+      bool first[256] = { false };
+
+      for (const auto& needle : *needles)
+      {
+        first[needle[0] & 0xff] = true;
+      }
+      for (runestring::size_type i = 0; i < length;)
+      {
+        runestring::size_type count = 0;
+
+        if (first[haystack[i] & 0xff])
+        {
+          for (runestring::size_type j = 0; j < needles->size(); ++j)
+          {
+            const needle_type& needle = (*needles)[j];
+
+            if (needle.size() <= length - i
+                && matches_at(haystack + i, needle))
+            {
+              matches->push_back(match_type(i, j));
+              count = needle.size();
+              break;
+            }
+          }
+        }
+        i += count ? count : 1;
+      }
+    }
+
+    template<class T>
+    void operator()(const T* haystack) const
+    {
+      if (needles->size() == 1)
+      {
+        find_one(haystack, needles->front());
+      } else {
+        find_many(haystack);
+      }
+    }
+  };
+
+  runestring& runestring::replace_all(const runestring& needle,
+                                      const runestring& replacement)
+  {
+    return replace_all(std::vector<std::pair<runestring, runestring>>(
+      1,
+      std::make_pair(needle, replacement)
+    ));
+  }
+
+  runestring& runestring::replace_all(
+    const std::vector<std::pair<runestring, runestring>>& pairs
+  )
+  {
+    const size_type old_length = this->length();
+    std::vector<const std::pair<runestring, runestring>*> used;
+    std::vector<needle_type> needles;
+    std::vector<match_type> matches;
+    size_type length = old_length;
+    unsigned shift = this->shift();
+    bool same_length = true;
+    size_type previous = 0;
+    runestring result;
+    unsigned char* runes;
+
+    for (const auto& pair : pairs)
+    {
+      if (!pair.first.empty() && pair.first.length() <= old_length)
+      {
+        used.push_back(&pair);
+        needles.push_back(needle_type(pair.first.begin(), pair.first.end()));
+      }
+    }
+    if (needles.empty())
+    {
+      return *this;
+    }
+    {
+      const find_all_function function = { old_length, &needles, &matches };
+
+      visit(data(), this->shift(), function);
+    }
+    if (matches.empty())
+    {
+      return *this;
+    }
+    for (const auto& match : matches)
+    {
+      const runestring& needle = used[match.second]->first;
+      const runestring& replacement = used[match.second]->second;
+
+      length = length - needle.length() + replacement.length();
+      shift = std::max(shift, replacement.shift());
+      same_length = same_length && needle.length() == replacement.length();
+    }
+    if (same_length
+        && shift == this->shift()
+        && (is_small() || is_extensible(length, shift)))
+    {
+      runes = data();
+      for (const auto& match : matches)
+      {
+        const runestring& replacement = used[match.second]->second;
+
+        replacement.copy_to(runes + (match.first << shift), shift);
+      }
+      modified();
+
+      return *this;
+    }
+    runes = result.prepare(length, shift);
+    for (const auto& match : matches)
+    {
+      const std::pair<runestring, runestring>& pair = *used[match.second];
+
+      copy_runes(
+        data() + (previous << this->shift()),
+        this->shift(),
+        match.first - previous,
+        runes,
+        shift
+      );
+      runes = pair.second.copy_to(
+        runes + ((match.first - previous) << shift),
+        shift
+      );
+      previous = match.first + pair.first.length();
+    }
+    copy_runes(
+      data() + (previous << this->shift()),
+      this->shift(),
+      old_length - previous,
+      runes,
+      shift
+    );
+
+    return assign(std::move(result));
+  }
+
+  runestring runestring::trim() const &
+  {
+    const size_type length = this->length();
+    size_type i, j;
+
+    for (i = 0; i < length; ++i)
+    {
+      if (!(*this)[i].is_space())
+      {
+        break;
+      }
+    }
+    for (j = length; j > i; --j)
+    {
+      if (!(*this)[j - 1].is_space())
+      {
+        break;
+      }
+    }
+    if (i == 0 && j == length)
+    {
+      return *this;
+    }
+
+    return substr(i, j - i);
+  }
+
+  runestring runestring::trim() &&
+  {
+    const size_type length = this->length();
+    size_type i, j;
+
+    if (is_small() || is_large() || !is_unique())
+    {
+      return trim();
+    }
+    for (i = 0; i < length; ++i)
+    {
+      if (!(*this)[i].is_space())
+      {
+        break;
+      }
+    }
+    for (j = length; j > i; --j)
+    {
+      if (!(*this)[j - 1].is_space())
+      {
+        break;
+      }
+    }
+    if (((j - i) << shift()) <= small_size || is_retention_limited(j - i))
+    {
+      return substr(i, j - i);
+    }
+    m_rep.heap.offset += static_cast<std::uint32_t>(i);
+    m_rep.heap.header = static_cast<std::uint32_t>(
+      ((j - i) << length_shift) | mode_heap | shift()
+    );
+
+    return std::move(*this);
+  }
+
+  runestring runestring::substr(size_type pos, size_type count) const
+  {
+    const size_type length = this->length();
+    runestring result;
+
+    if (pos >= length)
+    {
+      return result;
+    }
+    else if (count == npos || count + pos > length)
+    {
+      count = length - pos;
+    }
+    if (is_literal())
+    {
+      const max_code_function function = { count };
+      const unsigned char* runes = data() + (pos << shift());
+
+      result.refer(runes, count, shift(), visit(runes, shift(), function));
+    }
+    else if ((count << shift()) <= small_size || is_retention_limited(count))
+    {
+      std::memcpy(
+        result.prepare(count, shift()),
+        data() + (pos << shift()),
+        count << shift()
+      );
+    } else {
+      increment(storage()->counter);
+      result.locate(storage(), offset() + pos, count, shift());
+    }
+
+    return result;
+  }
+
+  runestring runestring::transform(
+    rune::value_type (*function)(rune::value_type)
+  ) const &
+  {
+    const size_type length = this->length();
+    runestring result;
+    const convert_function convert = {
+      length,
+      result.prepare(length, shift()),
+      shift(),
+      function
+    };
+    const size_type done = visit(data(), shift(), convert);
+
+    if (done < length)
+    {
+      return result.widen(done, *this, function);
+    }
+
+    return result;
+  }
+
+  runestring runestring::transform(
+    rune::value_type (*function)(rune::value_type)
+  ) &&
+  {
+    const size_type length = this->length();
+
+    if (!is_unique())
+    {
+      return transform(function);
+    } else {
+      const convert_function convert = { length, data(), shift(), function };
+      const size_type done = visit(data(), shift(), convert);
+
+      modified();
+      if (done < length)
+      {
+        return widen(done, *this, function);
+      }
+
+      return std::move(*this);
+    }
+  }
+
+  runestring runestring::widen(
+    size_type done,
+    const runestring& source,
+    rune::value_type (*function)(rune::value_type)
+  ) const
+  {
+    const size_type length = source.length();
+    const unsigned shift = std::max(
+      this->shift() + 1,
+      shift_of(function(source[done].code()))
+    );
+    runestring result;
+    unsigned char* runes = result.prepare(length, shift);
+    const convert_function convert = {
+      length - done,
+      runes + (done << shift),
+      shift,
+      function
+    };
+    size_type converted;
+
+    copy_runes(data(), this->shift(), done, runes, shift);
+    converted = visit(
+      source.data() + (done << source.shift()),
+      source.shift(),
+      convert
+    );
+    if (converted < length - done)
+    {
+      return result.widen(done + converted, source, function);
+    }
+
+    return result;
+  }
+
+  runestring runestring::to_lower() const &
+  {
+    return transform(
+      lower_function(max_code_bound())
+    );
+  }
+
+  runestring runestring::to_lower() &&
+  {
+    return std::move(*this).transform(
+      lower_function(max_code_bound())
+    );
+  }
+
+  runestring runestring::to_upper() const &
+  {
+    return transform(
+      upper_function(max_code_bound())
+    );
+  }
+
+  runestring runestring::to_upper() &&
+  {
+    return std::move(*this).transform(
+      upper_function(max_code_bound())
+    );
+  }
+
+  struct utf8_function
+  {
+    typedef void result_type;
+
+    runestring::size_type length;
+    std::string* result;
+
+    template<class T>
+    void operator()(const T* runes) const
+    {
+      char buffer[4];
+
+      for (runestring::size_type i = 0; i < length; ++i)
+      {
+        const rune::value_type c = runes[i];
+        std::size_t size;
+
+        if (c < 0x80)
+        {
+          *result += static_cast<char>(c);
+        }
+        else if (utf8_encode(buffer, size, c))
+        {
+          result->append(buffer, size);
+        }
+      }
+    }
+  };
+
+  runestring& runestring::make_lower()
+  {
+    return assign(std::move(*this).to_lower());
+  }
+
+  runestring& runestring::make_upper()
+  {
+    return assign(std::move(*this).to_upper());
+  }
+
+  std::string runestring::utf8() const
+  {
+    std::string result;
+
+    if (!shift() && max_code_bound() < 0x80)
+    {
+      return std::string(reinterpret_cast<const char*>(data()), length());
+    }
+    result.reserve(length());
+    append_utf8(result);
+
+    return result;
+  }
+
+  unsigned char* runestring::copy_to(unsigned char* runes,
+                                     unsigned shift) const
+  {
+    copy_runes(data(), this->shift(), length(), runes, shift);
+
+    return runes + (length() << shift);
+  }
+
+  struct utf8_size_function
+  {
+    typedef runestring::size_type result_type;
+
+    runestring::size_type length;
+
+    template<class T>
+    result_type operator()(const T* runes) const
+    {
+      result_type result = 0;
+      char buffer[4];
+
+      for (runestring::size_type i = 0; i < length; ++i)
+      {
+        std::size_t size;
+
+        if (runes[i] < 0x80)
+        {
+          ++result;
+        }
+        else if (utf8_encode(buffer, size, runes[i]))
+        {
+          result += size;
+        }
+      }
+
+      return result;
+    }
+  };
+
+  runestring::size_type runestring::utf8_size() const
+  {
+    const utf8_size_function function = { length() };
+
+    if (max_code_bound() < 0x80)
+    {
+      return length();
+    }
+
+    return visit(data(), shift(), function);
+  }
+
+  void runestring::append_utf8(std::string& output) const
+  {
+    if (!shift() && max_code_bound() < 0x80)
+    {
+      output.append(reinterpret_cast<const char*>(data()), length());
+    } else {
+      const utf8_function function = { length(), &output };
+
+      visit(data(), shift(), function);
+    }
+  }
+
+  struct utf16_function
+  {
+    typedef void result_type;
+
+    runestring::size_type length;
+    std::string* result;
+    bool big_endian;
+    bool bmp;
+
+    template<class T>
+    void operator()(const T* runes) const
+    {
+      std::string::size_type offset = 0;
+
+      // Runes narrower than 32 bits never require surrogate pairs.
+      if (sizeof(T) == 4 && !bmp)
+      {
+        std::string::size_type size = 0;
+
+        for (runestring::size_type i = 0; i < length; ++i)
+        {
+          size += runes[i] > 0xffff ? 4 : 2;
+        }
+        result->resize(size);
+      } else {
+        result->resize(length * 2);
+      }
+      for (runestring::size_type i = 0; i < length; ++i)
+      {
+        std::size_t size;
+
+        if (utf16_encode(&(*result)[offset], size, runes[i], big_endian))
+        {
+          offset += size;
+        }
+      }
+      result->resize(offset);
+    }
+  };
+
+  std::string runestring::utf16_be() const
+  {
+    std::string result;
+    const utf16_function function = {
+      length(),
+      &result,
+      true,
+      max_code_bound() < 0x10000
+    };
+
+    visit(data(), shift(), function);
+
+    return result;
+  }
+
+  std::string runestring::utf16_le() const
+  {
+    std::string result;
+    const utf16_function function = {
+      length(),
+      &result,
+      false,
+      max_code_bound() < 0x10000
+    };
+
+    visit(data(), shift(), function);
+
+    return result;
+  }
+
+  struct utf32_function
+  {
+    typedef void result_type;
+
+    runestring::size_type length;
+    std::string* result;
+    bool big_endian;
+
+    template<class T>
+    void operator()(const T* runes) const
+    {
+      result->resize(length * 4);
+      for (runestring::size_type i = 0; i < length; ++i)
+      {
+        const rune::value_type c = runes[i];
+        char* out = &(*result)[i * 4];
+
+        if (big_endian)
+        {
+          out[0] = static_cast<char>((c & 0xff000000) >> 24);
+          out[1] = static_cast<char>((c & 0xff0000) >> 16);
+          out[2] = static_cast<char>((c & 0xff00) >> 8);
+          out[3] = static_cast<char>(c & 0xff);
+        } else {
+          out[0] = static_cast<char>(c & 0xff);
+          out[1] = static_cast<char>((c & 0xff00) >> 8);
+          out[2] = static_cast<char>((c & 0xff0000) >> 16);
+          out[3] = static_cast<char>((c & 0xff000000) >> 24);
+        }
+      }
+    }
+  };
+
+  std::string runestring::utf32_be() const
+  {
+    std::string result;
+    const utf32_function function = { length(), &result, true };
+
+    visit(data(), shift(), function);
+
+    return result;
+  }
+
+  std::string runestring::utf32_le() const
+  {
+    std::string result;
+    const utf32_function function = { length(), &result, false };
+
+    visit(data(), shift(), function);
+
+    return result;
+  }
+
+  struct utf8_bounded_function
+  {
+    typedef runestring::encode_result result_type;
+
+    runestring::size_type length;
+    runestring::size_type budget;
+    char* out;
+
+    template<class T>
+    result_type operator()(const T* runes) const
+    {
+      result_type result = { 0, 0 };
+      char buffer[4];
+
+      for (; result.runes < length; ++result.runes)
+      {
+        const rune::value_type c = runes[result.runes];
+        std::size_t size;
+
+        if (c < 0x80)
+        {
+          if (result.bytes == budget)
+          {
+            break;
+          }
+          out[result.bytes++] = static_cast<char>(c);
+        }
+        else if (utf8_encode(buffer, size, c))
+        {
+          if (budget - result.bytes < size)
+          {
+            break;
+          }
+          std::copy(buffer, buffer + size, out + result.bytes);
+          result.bytes += size;
+        }
+      }
+
+      return result;
+    }
+  };
+
+  runestring::encode_result runestring::encode_utf8_bounded(
+    size_type pos,
+    size_type budget,
+    char* out
+  ) const
+  {
+    const encode_result empty = { 0, 0 };
+
+    if (pos >= length())
+    {
+      return empty;
+    } else {
+      const utf8_bounded_function function = {
+        length() - pos,
+        budget,
+        out
+      };
+
+      return visit(data() + (pos << shift()), shift(), function);
+    }
+  }
+
+  struct utf16_bounded_function
+  {
+    typedef runestring::encode_result result_type;
+
+    runestring::size_type length;
+    runestring::size_type budget;
+    char* out;
+    bool big_endian;
+
+    template<class T>
+    result_type operator()(const T* runes) const
+    {
+      result_type result = { 0, 0 };
+
+      for (; result.runes < length; ++result.runes)
+      {
+        const rune::value_type c = runes[result.runes];
+        std::size_t size = c > 0xffff ? 4 : 2;
+
+        if (budget - result.bytes < size)
+        {
+          break;
+        }
+        utf16_encode(out + result.bytes, size, c, big_endian);
+        result.bytes += size;
+      }
+
+      return result;
+    }
+  };
+
+  runestring::encode_result runestring::encode_utf16_be_bounded(
+    size_type pos,
+    size_type budget,
+    char* out
+  ) const
+  {
+    const encode_result empty = { 0, 0 };
+
+    if (pos >= length())
+    {
+      return empty;
+    } else {
+      const utf16_bounded_function function = {
+        length() - pos,
+        budget,
+        out,
+        true
+      };
+
+      return visit(data() + (pos << shift()), shift(), function);
+    }
+  }
+
+  runestring::encode_result runestring::encode_utf16_le_bounded(
+    size_type pos,
+    size_type budget,
+    char* out
+  ) const
+  {
+    const encode_result empty = { 0, 0 };
+
+    if (pos >= length())
+    {
+      return empty;
+    } else {
+      const utf16_bounded_function function = {
+        length() - pos,
+        budget,
+        out,
+        false
+      };
+
+      return visit(data() + (pos << shift()), shift(), function);
+    }
+  }
+
+  struct find_function
+  {
+    typedef runestring::size_type result_type;
+
+    runestring::size_type length;
+    runestring::size_type count;
+    runestring::size_type pos;
+
+    template<class A, class B>
+    result_type operator()(const A* haystack, const B* needle) const
+    {
+      const rune::value_type first = code_of(needle[0]);
+
+      for (runestring::size_type i = pos; i + count <= length; ++i)
+      {
+        if (haystack[i] != first)
+        {
+          continue;
+        }
+        for (runestring::size_type j = 1; ; ++j)
+        {
+          if (j == count)
+          {
+            return i;
+          }
+          else if (haystack[i + j] != code_of(needle[j]))
+          {
+            break;
+          }
+        }
+      }
+
+      return runestring::npos;
+    }
+  };
+
+  runestring::size_type runestring::find(const runestring& str,
+                                         size_type pos) const
+  {
+    if (!str)
+    {
+      return pos;
+    }
+    else if (str.length() > length())
+    {
+      return npos;
+    } else {
+      const find_function function = { length(), str.length(), pos };
+
+      return visit(data(), shift(), str.data(), str.shift(), function);
+    }
+  }
+
+  struct find_runes_function
+  {
+    typedef runestring::size_type result_type;
+
+    find_function find;
+    runestring::const_pointer needle;
+
+    template<class T>
+    result_type operator()(const T* haystack) const
+    {
+      return find(haystack, needle);
+    }
+  };
+
+  runestring::size_type runestring::find(const_pointer s,
+                                         size_type pos,
+                                         size_type count) const
+  {
+    if (!count)
+    {
+      return pos;
+    }
+    else if (count > length())
+    {
+      return npos;
+    } else {
+      const find_runes_function function = { { length(), count, pos }, s };
+
+      return visit(data(), shift(), function);
+    }
+  }
+
+  struct find_rune_function
+  {
+    typedef runestring::size_type result_type;
+
+    runestring::size_type length;
+    runestring::size_type pos;
+    rune::value_type needle;
+
+    template<class T>
+    result_type operator()(const T* haystack) const
+    {
+      for (runestring::size_type i = pos; i < length; ++i)
+      {
+        if (haystack[i] == needle)
+        {
+          return i;
+        }
+      }
+
+      return runestring::npos;
+    }
+  };
+
+  runestring::size_type runestring::find(const_reference needle,
+                                         size_type pos) const
+  {
+    if (pos >= length() || shift_of(needle.code()) > shift())
+    {
+      return npos;
+    }
+    else if (!shift())
+    {
+      const void* found = std::memchr(
+        data() + pos,
+        static_cast<int>(needle.code()),
+        length() - pos
+      );
+
+      return found
+        ? static_cast<size_type>(
+          static_cast<const unsigned char*>(found) - data()
+        )
+        : npos;
+    } else {
+      const find_rune_function function = { length(), pos, needle.code() };
+
+      return visit(data(), shift(), function);
+    }
+  }
+
+  struct rfind_function
+  {
+    typedef runestring::size_type result_type;
+
+    runestring::size_type length;
+    runestring::size_type count;
+
+    template<class A, class B>
+    result_type operator()(const A* haystack, const B* needle) const
+    {
+      for (runestring::size_type i = length; i > 0; --i)
+      {
+        if (i > count)
+        {
+          bool found = true;
+
+          for (runestring::size_type j = 0; j < count; ++j)
+          {
+            if (haystack[i - count + j - 1] != code_of(needle[j]))
+            {
+              found = false;
+              break;
+            }
+          }
+          if (found)
+          {
+            return i - count - 1;
+          }
+        }
+      }
+
+      return runestring::npos;
+    }
+  };
+
+  runestring::size_type runestring::rfind(const runestring& str,
+                                          size_type pos) const
+  {
+    if (pos != npos && (pos > length() || str.length() > length()))
+    {
+      return npos;
+    } else {
+      const rfind_function function = { length(), str.length() };
+
+      return visit(data(), shift(), str.data(), str.shift(), function);
+    }
+  }
+
+  struct rfind_runes_function
+  {
+    typedef runestring::size_type result_type;
+
+    rfind_function rfind;
+    runestring::const_pointer needle;
+
+    template<class T>
+    result_type operator()(const T* haystack) const
+    {
+      return rfind(haystack, needle);
+    }
+  };
+
+  runestring::size_type runestring::rfind(const_pointer s,
+                                          size_type pos,
+                                          size_type count) const
+  {
+    if (pos != npos && (pos > length() || count > length()))
+    {
+      return npos;
+    } else {
+      const rfind_runes_function function = { { length(), count }, s };
+
+      return visit(data(), shift(), function);
+    }
+  }
+
+  struct rfind_rune_function
+  {
+    typedef runestring::size_type result_type;
+
+    runestring::size_type pos;
+    rune::value_type needle;
+
+    template<class T>
+    result_type operator()(const T* haystack) const
+    {
+      for (runestring::size_type i = pos; i > 0; --i)
+      {
+        if (haystack[i - 1] == needle)
+        {
+          return i - 1;
+        }
+      }
+
+      return runestring::npos;
+    }
+  };
+
+  runestring::size_type runestring::rfind(const_reference needle,
+                                          size_type pos) const
+  {
+    if (pos == npos)
+    {
+      pos = length();
+    }
+    else if (pos > length())
+    {
+      return npos;
+    }
+    if (shift_of(needle.code()) > shift())
+    {
+      return npos;
+    } else {
+      const rfind_rune_function function = { pos, needle.code() };
+
+      return visit(data(), shift(), function);
+    }
+  }
+
+  template<class Vector>
+  static void split_lines(const runestring& str, Vector& result)
+  {
+    const runestring::size_type length = str.length();
+    runestring::size_type begin = 0;
+    runestring::size_type end = 0;
+
+    for (runestring::size_type i = 0; i < length; ++i)
+    {
+      const runestring::value_type r = str[i];
+
+      if (i + 1 < length
+          && r.equals('\r')
+          && str[i + 1].equals('\n'))
+      {
+        result.push_back(str.substr(begin, end - begin));
+        begin = end = i + 2;
+        ++i;
+      }
+      else if (r.equals('\n') || r.equals('\r'))
+      {
+        result.push_back(str.substr(begin, end - begin));
+        begin = end = i + 1;
+      } else {
+        ++end;
+      }
+    }
+    if (end - begin > 0)
+    {
+      result.push_back(str.substr(begin, end - begin));
+    }
+  }
+
+  std::vector<runestring> runestring::lines() const
+  {
+    std::vector<runestring> result;
+
+    split_lines(*this, result);
+
+    return result;
+  }
+
+  std::vector<runestring, polymorphic_allocator<runestring>>
+  runestring::lines(memory_resource* resource) const
+  {
+    std::vector<runestring, polymorphic_allocator<runestring>> result(
+      resource
+    );
+
+    split_lines(*this, result);
+
+    return result;
+  }
+
+  template<class Vector>
+  static void split_words(const runestring& str, Vector& result)
+  {
+    const runestring::size_type length = str.length();
+    runestring::size_type begin = 0;
+    runestring::size_type end = 0;
+
+    for (runestring::size_type i = 0; i < length; ++i)
+    {
+      if (str[i].is_space())
+      {
+        if (end - begin > 0)
+        {
+          result.push_back(str.substr(begin, end - begin));
+        }
+        begin = end = i + 1;
+      } else {
+        ++end;
+      }
+    }
+    if (end - begin > 0)
+    {
+      result.push_back(str.substr(begin, end - begin));
+    }
+  }
+
+  std::vector<runestring> runestring::words() const
+  {
+    std::vector<runestring> result;
+
+    split_words(*this, result);
+
+    return result;
+  }
+
+  std::vector<runestring, polymorphic_allocator<runestring>>
+  runestring::words(memory_resource* resource) const
+  {
+    std::vector<runestring, polymorphic_allocator<runestring>> result(
+      resource
+    );
+
+    split_words(*this, result);
+
+    return result;
+  }
+
+  memory_resource* runestring::resource() const
+  {
+    return is_small() || is_literal() ? nullptr : storage()->resource;
+  }
+
+  bool runestring::is_retention_limited(size_type length) const
+  {
+    const double threshold = substring_retention_threshold.load(
+      std::memory_order_relaxed
+    );
+
+    return threshold > 0.0 && length < storage()->capacity * threshold;
+  }
+
+  runestring runestring::compact() const
+  {
+    if (is_small() || is_literal() || storage()->capacity == length())
+    {
+      return *this;
+    }
+
+    return detach(get_default_resource());
+  }
+
+  runestring::size_type runestring::buffer_size() const
+  {
+    return is_small() || is_literal()
+      ? 0
+      : storage()->capacity << storage()->shift;
+  }
+
+  runestring::size_type runestring::use_count() const
+  {
+    return is_small() || is_literal()
+      ? 0
+      : storage()->counter.load(std::memory_order_relaxed);
+  }
+
+  double runestring::retention_threshold()
+  {
+    return substring_retention_threshold.load(std::memory_order_relaxed);
+  }
+
+  void runestring::set_retention_threshold(double fraction)
+  {
+    substring_retention_threshold.store(
+      fraction,
+      std::memory_order_relaxed
+    );
+  }
+
+  runestring runestring::detach(memory_resource* resource) const
+  {
+    const memory_resource_scope scope(resource);
+    const size_type length = this->length();
+    runestring result;
+
+    std::memcpy(
+      result.prepare(length, shift()),
+      data(),
+      length << shift()
+    );
+
+    return result;
+  }
+
+  runestring::iterator::iterator()
+    : m_pointer(nullptr)
+    , m_shift(0) {}
+
+  runestring::iterator::iterator(const iterator& that)
+    : m_pointer(that.m_pointer)
+    , m_shift(that.m_shift) {}
+
+  runestring::iterator& runestring::iterator::operator=(const iterator& that)
+  {
+    m_pointer = that.m_pointer;
+    m_shift = that.m_shift;
+
+    return *this;
+  }
+
+  runestring::iterator& runestring::iterator::operator++()
+  {
+    m_pointer += size_type(1) << m_shift;
+
+    return *this;
+  }
+
+  runestring::iterator runestring::iterator::operator++(int)
+  {
+    iterator return_value(*this);
+
+    m_pointer += size_type(1) << m_shift;
+
+    return return_value;
+  }
+
+  runestring::iterator& runestring::iterator::operator--()
+  {
+    m_pointer -= size_type(1) << m_shift;
+
+    return *this;
+  }
+
+  runestring::iterator runestring::iterator::operator--(int)
+  {
+    iterator return_value(*this);
+
+    m_pointer -= size_type(1) << m_shift;
+
+    return return_value;
+  }
+
+  runestring::iterator runestring::iterator::operator+(size_type n) const
+  {
+    iterator return_value;
+
+    return_value.m_pointer = m_pointer + (n << m_shift);
+    return_value.m_shift = m_shift;
+
+    return return_value;
+  }
+
+  runestring::iterator runestring::iterator::operator-(size_type n) const
+  {
+    iterator return_value;
+
+    return_value.m_pointer = m_pointer - (n << m_shift);
+    return_value.m_shift = m_shift;
+
+    return return_value;
+  }
+
+  runestring::iterator& runestring::iterator::operator+=(size_type n)
+  {
+    m_pointer += n << m_shift;
+
+    return *this;
+  }
+
+  runestring::iterator& runestring::iterator::operator-=(size_type n)
+  {
+    m_pointer -= n << m_shift;
+
+    return *this;
+  }
+
+  runestring::difference_type runestring::iterator::operator-(const iterator& that) const
+  {
+    return (m_pointer - that.m_pointer) / (difference_type(1) << m_shift);
+  }
+
+  runestring::format_argument::format_argument()
+    : m_kind(kind_none)
+    , m_size(0)
+  {
+    m_value.integer = 0;
+  }
+
+  runestring::format_argument::format_argument(const runestring& value)
+    : m_kind(kind_string)
+    , m_size(0)
+  {
+    m_value.string = &value;
+  }
+
+  runestring::format_argument::format_argument(const char* value)
+    : m_kind(kind_utf8)
+    , m_size(value ? std::strlen(value) : 0)
+  {
+    m_value.input = value;
+  }
+
+  runestring::format_argument::format_argument(const std::string& value)
+    : m_kind(kind_utf8)
+    , m_size(value.size())
+  {
+    m_value.input = value.data();
+  }
+
+  runestring::format_argument::format_argument(const rune& value)
+    : m_kind(kind_rune)
+    , m_size(0)
+  {
+    m_value.code = value.code();
+  }
+
+  runestring::format_argument::format_argument(char value)
+    : m_kind(kind_rune)
+    , m_size(0)
+  {
+    m_value.code = static_cast<unsigned char>(value);
+  }
+
+  runestring::format_argument::format_argument(bool value)
+    : m_kind(kind_bool)
+    , m_size(0)
+  {
+    m_value.boolean = value;
+  }
+
+  runestring::format_argument::format_argument(int value)
+    : m_kind(kind_signed)
+    , m_size(0)
+  {
+    m_value.integer = value;
+  }
+
+  runestring::format_argument::format_argument(long value)
+    : m_kind(kind_signed)
+    , m_size(0)
+  {
+    m_value.integer = value;
+  }
+
+  runestring::format_argument::format_argument(long long value)
+    : m_kind(kind_signed)
+    , m_size(0)
+  {
+    m_value.integer = value;
+  }
+
+  runestring::format_argument::format_argument(unsigned value)
+    : m_kind(kind_unsigned)
+    , m_size(0)
+  {
+    m_value.unsigned_integer = value;
+  }
+
+  runestring::format_argument::format_argument(unsigned long value)
+    : m_kind(kind_unsigned)
+    , m_size(0)
+  {
+    m_value.unsigned_integer = value;
+  }
+
+  runestring::format_argument::format_argument(unsigned long long value)
+    : m_kind(kind_unsigned)
+    , m_size(0)
+  {
+    m_value.unsigned_integer = value;
+  }
+
+  runestring::format_argument::format_argument(double value)
+    : m_kind(kind_double)
+    , m_size(0)
+  {
+    m_value.floating = value;
+  }
+
+  /**
+   * Format specification of a single placeholder.
+   */
+  struct format_spec
+  {
+    rune::value_type fill;
+    rune::value_type align;
+    bool zero;
+    runestring::size_type width;
+    runestring::size_type precision;
+    rune::value_type type;
+  };
+
+  /**
+   * Computes length and storage width of formatted string.
+   */
+  struct format_size_sink
+  {
+    runestring::size_type length;
+    unsigned shift;
+
+    void copy(const unsigned char*,
+              unsigned shift,
+              runestring::size_type count)
+    {
+      append(shift, count);
+    }
+
+    void decode(const char*,
+                std::size_t,
+                unsigned shift,
+                runestring::size_type count)
+    {
+      append(shift, count);
+    }
+
+    void ascii(const char*, runestring::size_type count)
+    {
+      length += count;
+    }
+
+    void repeat(rune::value_type, unsigned shift, runestring::size_type count)
+    {
+      append(shift, count);
+    }
 
-    return npos;
-  }
-
-  runestring::size_type runestring::find(const_reference needle,
-                                         size_type pos) const
-  {
-    while (pos < m_length)
+    void append(unsigned shift, runestring::size_type count)
     {
-      if (m_runes[m_offset + pos] == needle)
+      if (count)
       {
-        return pos;
+        length += count;
+        this->shift = std::max(this->shift, shift);
       }
-      ++pos;
     }
+  };
 
-    return npos;
-  }
-
-  runestring::size_type runestring::rfind(const runestring& str,
-                                          size_type pos) const
+  /**
+   * Writes formatted string into storage allocated for it.
+   */
+  struct format_write_sink
   {
-    if (pos == npos)
+    unsigned char* runes;
+    unsigned shift;
+
+    void copy(const unsigned char* source,
+              unsigned source_shift,
+              runestring::size_type count)
     {
-      pos = m_length;
+      copy_runes(source, source_shift, count, runes, shift);
+      runes += count << shift;
     }
-    else if (pos > m_length || str.m_length > m_length)
+
+    void decode(const char* input,
+                std::size_t size,
+                unsigned,
+                runestring::size_type count)
     {
-      return npos;
+      decode_runes(input, size, runes, shift);
+      runes += count << shift;
     }
-    for (size_type i = m_length; i > 0; --i)
+
+    void ascii(const char* text, runestring::size_type count)
     {
-      if (i > str.m_length)
+      for (runestring::size_type i = 0; i < count; ++i)
       {
-        bool found = true;
+        store(runes, shift, i, static_cast<unsigned char>(text[i]));
+      }
+      runes += count << shift;
+    }
 
-        for (size_type j = 0; j < str.m_length; ++j)
-        {
-          if (m_runes[m_offset + i - str.m_length + j - 1] != str.m_runes[str.m_offset + j])
-          {
-            found = false;
-            break;
-          }
-        }
-        if (found)
-        {
-          return i - str.m_length - 1;
-        }
+    void repeat(rune::value_type code, unsigned, runestring::size_type count)
+    {
+      for (runestring::size_type i = 0; i < count; ++i)
+      {
+        store(runes, shift, i, code);
       }
+      runes += count << shift;
     }
+  };
 
-    return npos;
+  /**
+   * Parses decimal number from given position of the pattern. Returns
+   * <code>npos</code> if there is no number in the position.
+   */
+  static runestring::size_type parse_number(const runestring& pattern,
+                                            runestring::size_type& pos)
+  {
+    runestring::size_type result = runestring::npos;
+
+    while (pos < pattern.length() && pattern[pos].is_digit())
+    {
+      const runestring::size_type digit = pattern[pos++].code() - '0';
+
+      result = (result == runestring::npos ? 0 : result * 10) + digit;
+    }
+
+    return result;
   }
 
-  runestring::size_type runestring::rfind(const_pointer s,
-                                          size_type pos,
-                                          size_type count) const
+  static bool is_align(rune::value_type c)
   {
-    if (pos == npos)
+    return c == '<' || c == '>' || c == '^';
+  }
+
+  static void parse_spec(const runestring& pattern,
+                         runestring::size_type& pos,
+                         format_spec& spec)
+  {
+    const runestring::size_type length = pattern.length();
+
+    if (pos + 1 < length && is_align(pattern[pos + 1].code()))
     {
-      pos = m_length;
+      spec.fill = pattern[pos].code();
+      spec.align = pattern[pos + 1].code();
+      pos += 2;
     }
-    else if (pos > m_length || count > m_length)
+    else if (pos < length && is_align(pattern[pos].code()))
     {
-      return npos;
+      spec.align = pattern[pos++].code();
     }
-    for (size_type i = m_length; i > 0; --i)
+    if (pos < length && pattern[pos].code() == '0')
     {
-      if (i > count)
+      spec.zero = true;
+      ++pos;
+    }
+    spec.width = parse_number(pattern, pos);
+    if (spec.width == runestring::npos)
+    {
+      spec.width = 0;
+    }
+    if (pos < length && pattern[pos].code() == '.')
+    {
+      ++pos;
+      spec.precision = parse_number(pattern, pos);
+      if (spec.precision == runestring::npos)
       {
-        bool found = true;
-
-        for (size_type j = 0; j < count; ++j)
-        {
-          if (m_runes[m_offset + i - count + j - 1] != s[j])
-          {
-            found = false;
-            break;
-          }
-        }
-        if (found)
-        {
-          return i - count - 1;
-        }
+        throw std::invalid_argument("missing precision in format pattern");
       }
     }
-
-    return npos;
+    if (pos < length
+        && pattern[pos].code() < 0x80
+        && pattern[pos].code()
+        && std::strchr("bdeEfgGoxX", static_cast<int>(pattern[pos].code())))
+    {
+      spec.type = pattern[pos++].code();
+    }
   }
 
-  runestring::size_type runestring::rfind(const_reference needle,
-                                          size_type pos) const
+  /**
+   * Formats integer backwards into buffer ending at given pointer. Returns
+   * pointer to the first digit.
+   */
+  static char* format_integer(char* end,
+                              unsigned long long value,
+                              rune::value_type type)
   {
-    if (pos == npos)
-    {
-      pos = m_length;
-    }
-    else if (pos > m_length)
+    const char* digits = type == 'X'
+      ? "0123456789ABCDEF"
+      : "0123456789abcdef";
+    const unsigned base = type == 'x' || type == 'X'
+      ? 16
+      : type == 'o' ? 8 : type == 'b' ? 2 : 10;
+
+    do
     {
-      return npos;
+      *--end = digits[value % base];
+      value /= base;
     }
-    for (size_type i = pos; i > 0; --i)
-    {
-      if (m_runes[m_offset + i - 1] == needle)
+    while (value);
+
+    return end;
+  }
+
+  /**
+   * Formats floating point number into given buffer. Without type nor
+   * precision, the shortest representation which reads back as the same
+   * value is used. The number is always formatted with the "C" locale, so
+   * that the decimal point does not depend on the global locale.
+   */
+  static std::size_t format_double(char* buffer,
+                                   std::size_t size,
+                                   double value,
+                                   const format_spec& spec)
+  {
+    static const locale_t c_locale = ::newlocale(
+      LC_NUMERIC_MASK,
+      "C",
+      static_cast<locale_t>(0)
+    );
+    const int precision = spec.precision == runestring::npos
+      ? 6
+      : static_cast<int>(std::min<runestring::size_type>(spec.precision, 64));
+    const locale_t previous = ::uselocale(c_locale);
+    int result = 0;
+
+    if (!spec.type && spec.precision == runestring::npos)
+    {
+      for (int digits = 1; digits <= 17; ++digits)
       {
-        return i - 1;
+        result = std::snprintf(buffer, size, "%.*g", digits, value);
+        if (std::strtod(buffer, nullptr) == value)
+        {
+          break;
+        }
       }
+    } else {
+      const char type = spec.type && std::strchr("eEfgG", spec.type)
+        ? static_cast<char>(spec.type)
+        : 'g';
+      const char format[] = { '%', '.', '*', type, '\0' };
+
+      result = std::snprintf(buffer, size, format, precision, value);
     }
+    ::uselocale(previous);
 
-    return npos;
+    return std::min(static_cast<std::size_t>(std::max(result, 0)), size - 1);
   }
 
-  std::vector<runestring> runestring::lines() const
+  /**
+   * Writes padding around contents of a field.
+   */
+  template<class Sink, class Content>
+  static void format_padded(Sink& sink,
+                            const format_spec& spec,
+                            runestring::size_type length,
+                            rune::value_type default_align,
+                            const Content& content)
   {
-    std::vector<runestring> result;
-    size_type begin = 0;
-    size_type end = 0;
+    const unsigned fill_shift = spec.fill < 0x100
+      ? 0
+      : spec.fill < 0x10000 ? 1 : 2;
+    const rune::value_type align = spec.align ? spec.align : default_align;
+    const runestring::size_type padding = spec.width > length
+      ? spec.width - length
+      : 0;
+    const runestring::size_type before = align == '>'
+      ? padding
+      : align == '^' ? padding / 2 : 0;
+
+    sink.repeat(spec.fill, fill_shift, before);
+    content();
+    sink.repeat(spec.fill, fill_shift, padding - before);
+  }
 
-    for (size_type i = 0; i < m_length; ++i)
-    {
-      const_reference r = m_runes[m_offset + i];
+  template<class Sink>
+  static void format_number(Sink& sink,
+                            const format_spec& spec,
+                            bool negative,
+                            const char* digits,
+                            runestring::size_type count)
+  {
+    const runestring::size_type length = count + (negative ? 1 : 0);
 
-      if (i + 1 < m_length
-          && r.equals('\r')
-          && m_runes[m_offset + i + 1].equals('\n'))
+    if (spec.zero && !spec.align)
+    {
+      if (negative)
       {
-        result.push_back(substr(begin, end - begin));
-        begin = end = i + 2;
-        ++i;
+        sink.ascii("-", 1);
       }
-      else if (r.equals('\n') || r.equals('\r'))
+      sink.repeat('0', 0, spec.width > length ? spec.width - length : 0);
+      sink.ascii(digits, count);
+    } else {
+      format_padded(sink, spec, length, '>', [&]()
       {
-        result.push_back(substr(begin, end - begin));
-        begin = end = i + 1;
-      } else {
-        ++end;
-      }
-    }
-    if (end - begin > 0)
-    {
-      result.push_back(substr(begin, end - begin));
+        if (negative)
+        {
+          sink.ascii("-", 1);
+        }
+        sink.ascii(digits, count);
+      });
     }
-
-    return result;
   }
 
-  std::vector<runestring> runestring::words() const
+  template<class Sink>
+  void runestring::format_fields(const runestring& pattern,
+                                 const format_argument* arguments,
+                                 size_type count,
+                                 Sink& sink)
   {
-    std::vector<runestring> result;
+    const size_type length = pattern.length();
+    const unsigned shift = pattern.shift();
+    size_type next = 0;
     size_type begin = 0;
-    size_type end = 0;
+    size_type pos = 0;
 
-    for (size_type i = 0; i < m_length; ++i)
+    while (pos < length)
     {
-      const_reference r = m_runes[m_offset + i];
+      const rune::value_type c = pattern[pos].code();
+      format_spec spec = { ' ', 0, false, 0, npos, 0 };
+      size_type index;
 
-      if (r.is_space())
+      if (c != '{' && c != '}')
       {
-        if (end - begin > 0)
-        {
-          result.push_back(substr(begin, end - begin));
-        }
-        begin = end = i + 1;
-      } else {
-        ++end;
+        ++pos;
+        continue;
       }
-    }
-    if (end - begin > 0)
-    {
-      result.push_back(substr(begin, end - begin));
-    }
+      sink.copy(pattern.data() + (begin << shift), shift, pos - begin);
+      if (pos + 1 < length && pattern[pos + 1].code() == c)
+      {
+        begin = pos + 1;
+        pos += 2;
+        continue;
+      }
+      else if (c == '}')
+      {
+        throw std::invalid_argument("unmatched '}' in format pattern");
+      }
+      ++pos;
+      index = parse_number(pattern, pos);
+      if (index == npos)
+      {
+        index = next;
+      }
+      next = index + 1;
+      if (pos < length && pattern[pos].code() == ':')
+      {
+        parse_spec(pattern, ++pos, spec);
+      }
+      if (pos >= length || pattern[pos].code() != '}')
+      {
+        throw std::invalid_argument("invalid placeholder in format pattern");
+      }
+      else if (index >= count)
+      {
+        throw std::out_of_range("format argument index out of bounds");
+      }
+      begin = ++pos;
 
-    return result;
-  }
+      const format_argument& argument = arguments[index];
+      char buffer[512];
+      char* end = buffer + sizeof(buffer);
 
-  runestring::iterator::iterator()
-    : m_pointer(nullptr) {}
+      switch (argument.m_kind)
+      {
+        case format_argument::kind_string:
+          {
+            const runestring& str = *argument.m_value.string;
+            const size_type runes = std::min(str.length(), spec.precision);
 
-  runestring::iterator::iterator(const iterator& that)
-    : m_pointer(that.m_pointer) {}
+            format_padded(sink, spec, runes, '<', [&]()
+            {
+              sink.copy(str.data(), str.shift(), runes);
+            });
+          }
+          break;
 
-  runestring::iterator& runestring::iterator::operator=(const iterator& that)
-  {
-    m_pointer = that.m_pointer;
+        case format_argument::kind_utf8:
+          {
+            const char* input = argument.m_value.input;
+            rune::value_type max_code;
+            std::size_t size;
+            size_type runes = utf8_count_runes(
+              input,
+              argument.m_size,
+              size,
+              max_code
+            );
+
+            if (runes > spec.precision)
+            {
+              runes = 0;
+              for (size = 0; runes <= spec.precision; ++size)
+              {
+                if ((input[size] & 0xc0) != 0x80 && runes++ == spec.precision)
+                {
+                  break;
+                }
+              }
+              runes = spec.precision;
+            }
+            format_padded(sink, spec, runes, '<', [&]()
+            {
+              sink.decode(input, size, shift_of(max_code), runes);
+            });
+          }
+          break;
 
-    return *this;
-  }
+        case format_argument::kind_rune:
+          format_padded(sink, spec, 1, '<', [&]()
+          {
+            sink.repeat(
+              argument.m_value.code,
+              shift_of(argument.m_value.code),
+              1
+            );
+          });
+          break;
 
-  runestring::iterator& runestring::iterator::operator++()
-  {
-    ++m_pointer;
+        case format_argument::kind_bool:
+          {
+            const char* text = argument.m_value.boolean ? "true" : "false";
+            const size_type runes = std::strlen(text);
 
-    return *this;
-  }
+            format_padded(sink, spec, runes, '<', [&]()
+            {
+              sink.ascii(text, runes);
+            });
+          }
+          break;
 
-  runestring::iterator runestring::iterator::operator++(int)
-  {
-    iterator return_value(*this);
+        case format_argument::kind_signed:
+          {
+            const long long value = argument.m_value.integer;
+            const char* digits = format_integer(
+              end,
+              value < 0
+                ? 0ULL - static_cast<unsigned long long>(value)
+                : static_cast<unsigned long long>(value),
+              spec.type
+            );
+
+            format_number(sink, spec, value < 0, digits, end - digits);
+          }
+          break;
 
-    ++m_pointer;
+        case format_argument::kind_unsigned:
+          {
+            const char* digits = format_integer(
+              end,
+              argument.m_value.unsigned_integer,
+              spec.type
+            );
 
-    return return_value;
-  }
+            format_number(sink, spec, false, digits, end - digits);
+          }
+          break;
 
-  runestring::iterator& runestring::iterator::operator--()
-  {
-    --m_pointer;
+        case format_argument::kind_double:
+          {
+            const size_type size = format_double(
+              buffer,
+              sizeof(buffer),
+              argument.m_value.floating,
+              spec
+            );
+            const bool negative = buffer[0] == '-';
+
+            format_number(
+              sink,
+              spec,
+              negative,
+              buffer + negative,
+              size - negative
+            );
+          }
+          break;
 
-    return *this;
+        default:
+          break;
+      }
+    }
+    sink.copy(pattern.data() + (begin << shift), shift, length - begin);
   }
 
-  runestring::iterator runestring::iterator::operator--(int)
+  runestring runestring::format_arguments(const runestring& pattern,
+                                          const format_argument* arguments,
+                                          size_type count)
   {
-    iterator return_value(*this);
-
-    --m_pointer;
-
-    return return_value;
-  }
+    format_size_sink size = { 0, 0 };
+    runestring result;
 
-  runestring::iterator runestring::iterator::operator+(size_type n) const
-  {
-    iterator return_value;
+    format_fields(pattern, arguments, count, size);
+    {
+      format_write_sink write = {
+        result.prepare(size.length, size.shift),
+        size.shift
+      };
 
-    return_value.m_pointer = m_pointer + n;
+      format_fields(pattern, arguments, count, write);
+    }
 
-    return return_value;
+    return result;
   }
 
-  runestring::iterator runestring::iterator::operator-(size_type n) const
+  runestring operator""_rs(const char* input, std::size_t size)
   {
-    iterator return_value;
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(
+      input
+    );
+    const unsigned char max_code = size ? *std::max_element(
+      bytes,
+      bytes + size
+    ) : 0;
+    runestring result;
 
-    return_value.m_pointer = m_pointer - n;
+    if (max_code >= 0x80 || size >= runestring::max_heap_length)
+    {
+      return runestring(input, size);
+    }
+    result.refer(bytes, size, 0, max_code);
 
-    return return_value;
+    return result;
   }
 
-  runestring::iterator& runestring::iterator::operator+=(size_type n)
+  runestring operator""_rs(const char32_t* input, std::size_t size)
   {
-    m_pointer += n;
-
-    return *this;
-  }
+    const rune::value_type* runes = reinterpret_cast<const rune::value_type*>(
+      input
+    );
+    rune::value_type max_code = 0;
+    runestring result;
 
-  runestring::iterator& runestring::iterator::operator-=(size_type n)
-  {
-    m_pointer -= n;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      max_code = std::max(max_code, runes[i]);
+    }
+    if (max_code > rune::max.code())
+    {
+      throw std::out_of_range("code point too large");
+    }
+    else if (size >= runestring::max_heap_length)
+    {
+      const unsigned shift = runestring::shift_of(max_code);
+      const copy_function copy = { size, result.prepare(size, shift), shift };
 
-    return *this;
-  }
+      copy(runes);
+    } else {
+      result.refer(
+        reinterpret_cast<const unsigned char*>(input),
+        size,
+        2,
+        max_code
+      );
+    }
 
-  runestring::difference_type runestring::iterator::operator-(const iterator& that) const
-  {
-    return m_pointer - that.m_pointer;
+    return result;
   }
 
   std::ostream& operator<<(std::ostream& os, const runestring& str)
@@ -1066,4 +3661,104 @@ namespace peelo
 
     return true;
   }
+
+  runestring::concat_operand runestring::make_operand(
+    const runestring& string
+  )
+  {
+    const concat_operand result = {
+      &string,
+      nullptr,
+      0,
+      string.length(),
+      0,
+      string.shift()
+    };
+
+    return result;
+  }
+
+  runestring::concat_operand runestring::make_operand(const_reference r)
+  {
+    const concat_operand result = {
+      nullptr,
+      nullptr,
+      r.code(),
+      1,
+      0,
+      shift_of(r.code())
+    };
+
+    return result;
+  }
+
+  runestring::concat_operand runestring::make_operand(const char* input)
+  {
+    concat_operand result = { nullptr, input, 0, 0, 0, 0 };
+
+    if (input && *input)
+    {
+      rune::value_type max_code;
+
+      result.length = utf8_count_runes(
+        input,
+        std::strlen(input),
+        result.size,
+        max_code
+      );
+      result.shift = shift_of(max_code);
+    }
+
+    return result;
+  }
+
+  runestring runestring::concatenate_operands(
+    std::initializer_list<concat_operand> operands
+  )
+  {
+    runestring result;
+    size_type length = 0;
+    unsigned shift = 0;
+    unsigned char* runes;
+
+    for (const auto& operand : operands)
+    {
+      length += operand.length;
+      shift = std::max(shift, operand.shift);
+    }
+    if (!length)
+    {
+      return result;
+    }
+    runes = result.prepare(length, shift);
+    for (const auto& operand : operands)
+    {
+      if (operand.string)
+      {
+        copy_runes(
+          operand.string->data(),
+          operand.string->shift(),
+          operand.length,
+          runes,
+          shift
+        );
+      }
+      else if (operand.input)
+      {
+        decode_runes(operand.input, operand.size, runes, shift);
+      }
+      else if (operand.length)
+      {
+        store(runes, shift, 0, operand.code);
+      }
+      runes += operand.length << shift;
+    }
+
+    return result;
+  }
+
+  runestring operator+(const char* input, const runestring& str)
+  {
+    return runestring::concatenate(input, str);
+  }
 }
@@ -0,0 +1,346 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <peelo/text/runestring_builder.hpp>
+#include <algorithm>
+#include <cstring>
+
+namespace peelo
+{
+  std::size_t utf8_count_runes(const char*,
+                               std::size_t,
+                               std::size_t&,
+                               rune::value_type&);
+  void copy_runes(const unsigned char*,
+                  unsigned,
+                  runestring::size_type,
+                  unsigned char*,
+                  unsigned);
+  std::size_t decode_runes(const char*,
+                           std::size_t,
+                           unsigned char*,
+                           unsigned);
+
+  /** Capacity of the first buffer allocated by a builder. */
+  static const runestring::size_type min_capacity = 32;
+
+  template<class T>
+  static void fill_runes(unsigned char* runes,
+                         runestring::size_type count,
+                         rune::value_type code)
+  {
+    std::fill_n(reinterpret_cast<T*>(runes), count, static_cast<T>(code));
+  }
+
+  runestring_builder::runestring_builder()
+    : m_buffer(nullptr)
+    , m_length(0) {}
+
+  runestring_builder::runestring_builder(size_type capacity)
+    : m_buffer(nullptr)
+    , m_length(0)
+  {
+    reserve(capacity);
+  }
+
+  runestring_builder::runestring_builder(runestring_builder&& that) noexcept
+    : m_buffer(that.m_buffer)
+    , m_length(that.m_length)
+  {
+    that.m_buffer = nullptr;
+    that.m_length = 0;
+  }
+
+  runestring_builder::~runestring_builder()
+  {
+    if (m_buffer)
+    {
+      runestring::release(m_buffer);
+    }
+  }
+
+  runestring_builder& runestring_builder::operator=(
+    runestring_builder&& that
+  ) noexcept
+  {
+    if (this != &that)
+    {
+      if (m_buffer)
+      {
+        runestring::release(m_buffer);
+      }
+      m_buffer = that.m_buffer;
+      m_length = that.m_length;
+      that.m_buffer = nullptr;
+      that.m_length = 0;
+    }
+
+    return *this;
+  }
+
+  runestring_builder::size_type runestring_builder::capacity() const
+  {
+    return m_buffer ? m_buffer->capacity : 0;
+  }
+
+  void runestring_builder::reserve(size_type capacity)
+  {
+    if (capacity > this->capacity())
+    {
+      const unsigned shift = m_buffer ? m_buffer->shift : 0;
+      runestring::buffer* buffer = runestring::allocate(capacity, shift);
+
+      if (m_buffer)
+      {
+        std::memcpy(buffer->bytes(), m_buffer->bytes(), m_length << shift);
+        runestring::release(m_buffer);
+      }
+      m_buffer = buffer;
+    }
+  }
+
+  void runestring_builder::clear()
+  {
+    m_length = 0;
+    // Reinterpret the buffer as one byte wide, so that contents appended
+    // after clearing don't inherit the storage width of previous contents.
+    if (m_buffer)
+    {
+      m_buffer->capacity <<= m_buffer->shift;
+      m_buffer->shift = 0;
+    }
+  }
+
+  runestring runestring_builder::str()
+  {
+    runestring result;
+    unsigned shift;
+
+    if (!m_length)
+    {
+      return result;
+    }
+    shift = m_buffer->shift;
+    if ((m_length << shift) <= runestring::small_size)
+    {
+      std::memcpy(
+        result.prepare(m_length, shift),
+        m_buffer->bytes(),
+        m_length << shift
+      );
+      clear();
+    } else {
+      m_buffer->length = m_length;
+      result.locate(m_buffer, 0, m_length, shift);
+      m_buffer = nullptr;
+      m_length = 0;
+    }
+
+    return result;
+  }
+
+  unsigned char* runestring_builder::extend(size_type count, unsigned shift)
+  {
+    const size_type length = m_length + count;
+    unsigned char* runes;
+
+    if (!m_buffer
+        || m_buffer->capacity < length
+        || m_buffer->shift < shift)
+    {
+      size_type capacity = std::max(length, min_capacity);
+      runestring::buffer* buffer;
+
+      if (m_buffer)
+      {
+        shift = std::max(shift, m_buffer->shift);
+        if (m_buffer->capacity < length)
+        {
+          capacity = std::max(
+            capacity,
+            m_buffer->capacity + m_buffer->capacity / 2
+          );
+        } else {
+          capacity = m_buffer->capacity;
+        }
+      }
+      buffer = runestring::allocate(capacity, shift);
+      if (m_buffer)
+      {
+        copy_runes(
+          m_buffer->bytes(),
+          m_buffer->shift,
+          m_length,
+          buffer->bytes(),
+          shift
+        );
+        runestring::release(m_buffer);
+      }
+      m_buffer = buffer;
+    }
+    runes = m_buffer->bytes() + (m_length << m_buffer->shift);
+    m_length = length;
+
+    return runes;
+  }
+
+  runestring_builder& runestring_builder::append(const rune& r)
+  {
+    return append(1, r);
+  }
+
+  runestring_builder& runestring_builder::append(size_type count,
+                                                 const rune& r)
+  {
+    unsigned char* runes;
+
+    if (!count)
+    {
+      return *this;
+    }
+    runes = extend(count, runestring::shift_of(r.code()));
+    switch (m_buffer->shift)
+    {
+      case 0:
+        fill_runes<std::uint8_t>(runes, count, r.code());
+        break;
+
+      case 1:
+        fill_runes<std::uint16_t>(runes, count, r.code());
+        break;
+
+      default:
+        fill_runes<std::uint32_t>(runes, count, r.code());
+        break;
+    }
+
+    return *this;
+  }
+
+  runestring_builder& runestring_builder::append(const runestring& str)
+  {
+    const size_type length = str.length();
+
+    if (length)
+    {
+      unsigned char* runes = extend(length, str.shift());
+
+      copy_runes(str.data(), str.shift(), length, runes, m_buffer->shift);
+    }
+
+    return *this;
+  }
+
+  runestring_builder& runestring_builder::append(const char* input)
+  {
+    return append(input, input ? std::strlen(input) : 0);
+  }
+
+  runestring_builder& runestring_builder::append(const char* input,
+                                                 size_type size)
+  {
+    size_type consumed;
+    size_type length;
+    rune::value_type max_code;
+
+    if (!input || !size)
+    {
+      return *this;
+    }
+    length = utf8_count_runes(input, size, consumed, max_code);
+    if (length)
+    {
+      unsigned char* runes = extend(length, runestring::shift_of(max_code));
+
+      decode_runes(input, consumed, runes, m_buffer->shift);
+    }
+
+    return *this;
+  }
+
+  runestring_builder& runestring_builder::append(int value)
+  {
+    return append(static_cast<long long>(value));
+  }
+
+  runestring_builder& runestring_builder::append(long value)
+  {
+    return append(static_cast<long long>(value));
+  }
+
+  runestring_builder& runestring_builder::append(long long value)
+  {
+    if (value < 0)
+    {
+      return append_integer(0ULL - static_cast<unsigned long long>(value),
+                            true);
+    }
+
+    return append_integer(static_cast<unsigned long long>(value), false);
+  }
+
+  runestring_builder& runestring_builder::append(unsigned value)
+  {
+    return append_integer(value, false);
+  }
+
+  runestring_builder& runestring_builder::append(unsigned long value)
+  {
+    return append_integer(value, false);
+  }
+
+  runestring_builder& runestring_builder::append(unsigned long long value)
+  {
+    return append_integer(value, false);
+  }
+
+  runestring_builder& runestring_builder::append_integer(
+    unsigned long long value,
+    bool negative
+  )
+  {
+    unsigned char digits[24];
+    unsigned char* end = digits + sizeof(digits);
+    unsigned char* begin = end;
+    size_type count;
+    unsigned char* runes;
+
+    do
+    {
+      *--begin = static_cast<unsigned char>('0' + value % 10);
+      value /= 10;
+    }
+    while (value);
+    if (negative)
+    {
+      *--begin = '-';
+    }
+    count = static_cast<size_type>(end - begin);
+    runes = extend(count, 0);
+    copy_runes(begin, 0, count, runes, m_buffer->shift);
+
+    return *this;
+  }
+}
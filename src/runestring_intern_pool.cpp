@@ -0,0 +1,368 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <peelo/text/runestring_intern_pool.hpp>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace peelo
+{
+  bool utf8_encode(char*, std::size_t&, rune::value_type);
+
+  /** Number of slots in the hash table of a shard when it's created. */
+  static const std::size_t min_slots = 16;
+
+  /**
+   * 64-bit FNV-1a hash over bytes.
+   */
+  static std::size_t hash_bytes(const char* input, std::size_t size)
+  {
+    std::uint64_t result = 0xcbf29ce484222325ULL;
+
+    for (std::size_t i = 0; i < size; ++i)
+    {
+      result = (result ^ static_cast<unsigned char>(input[i]))
+        * 0x100000001b3ULL;
+    }
+
+    return static_cast<std::size_t>(result);
+  }
+
+  /**
+   * Returns given string if it's storage can be kept in the pool as it is,
+   * or copy of it allocated from <code>new_delete_resource()</code>. Strings
+   * allocated from other resources might not live as long as the pool, and
+   * substrings would keep rest of their buffers alive.
+   */
+  static runestring pooled(const runestring& str)
+  {
+    memory_resource* resource = str.resource();
+
+    if (!resource
+        || (resource == new_delete_resource()
+            && str.buffer_size() == str.length() * str.width()))
+    {
+      return str;
+    }
+
+    return str.detach(new_delete_resource());
+  }
+
+  struct runestring_intern_pool::entry
+  {
+    /** Hash of the UTF-8 encoded bytes. */
+    std::size_t hash;
+    /** UTF-8 encoded bytes of the string. */
+    std::string key;
+    /** The string itself. */
+    runestring str;
+    symbol_type symbol;
+  };
+
+  /**
+   * Part of the pool. Strings are placed into shards by low bits of their
+   * hash, and into slots of the shard by the remaining bits. Entries are
+   * never moved nor modified once they have been added, so they can be read
+   * after the mutex has been released.
+   */
+  struct runestring_intern_pool::shard
+  {
+    mutable std::mutex mutex;
+    /** Open addressing hash table of entry indexes plus one. */
+    std::vector<std::uint32_t> slots;
+    std::deque<entry> entries;
+    unsigned shift;
+
+    explicit shard(unsigned shift)
+      : slots(min_slots, 0)
+      , shift(shift) {}
+
+    const entry* find(const char* input,
+                      std::size_t size,
+                      std::size_t hash) const
+    {
+      const std::size_t mask = slots.size() - 1;
+
+      for (std::size_t i = (hash >> shift) & mask;
+           slots[i];
+           i = (i + 1) & mask)
+      {
+        const entry& e = entries[slots[i] - 1];
+
+        if (e.hash == hash
+            && e.key.length() == size
+            && !std::memcmp(e.key.data(), input, size))
+        {
+          return &e;
+        }
+      }
+
+      return nullptr;
+    }
+
+    const entry& add(entry&& e)
+    {
+      entries.push_back(std::move(e));
+      if (entries.size() * 2 > slots.size())
+      {
+        std::vector<std::uint32_t>(slots.size() * 2, 0).swap(slots);
+        for (std::size_t i = 0; i < entries.size(); ++i)
+        {
+          place(i);
+        }
+      } else {
+        place(entries.size() - 1);
+      }
+
+      return entries.back();
+    }
+
+    void place(std::size_t index)
+    {
+      const std::size_t mask = slots.size() - 1;
+      std::size_t i = (entries[index].hash >> shift) & mask;
+
+      while (slots[i])
+      {
+        i = (i + 1) & mask;
+      }
+      slots[i] = static_cast<std::uint32_t>(index + 1);
+    }
+  };
+
+  runestring_intern_pool::runestring_intern_pool(size_type shards)
+    : m_shard_bits(0)
+  {
+    while ((size_type(1) << m_shard_bits) < shards && m_shard_bits < 16)
+    {
+      ++m_shard_bits;
+    }
+    shards = size_type(1) << m_shard_bits;
+    m_shards.reset(new std::unique_ptr<shard>[shards]);
+    for (size_type i = 0; i < shards; ++i)
+    {
+      m_shards[i].reset(new shard(m_shard_bits));
+    }
+  }
+
+  runestring_intern_pool::~runestring_intern_pool() {}
+
+  runestring_intern_pool::size_type runestring_intern_pool::size() const
+  {
+    const size_type shards = size_type(1) << m_shard_bits;
+    size_type result = 0;
+
+    for (size_type i = 0; i < shards; ++i)
+    {
+      std::lock_guard<std::mutex> lock(m_shards[i]->mutex);
+
+      result += m_shards[i]->entries.size();
+    }
+
+    return result;
+  }
+
+  runestring runestring_intern_pool::intern(const runestring& str)
+  {
+    return lookup(str).str;
+  }
+
+  runestring runestring_intern_pool::intern(const char* input)
+  {
+    return lookup(input, input ? std::strlen(input) : 0).str;
+  }
+
+  runestring runestring_intern_pool::intern(const char* input, size_type size)
+  {
+    return lookup(input, size).str;
+  }
+
+  runestring runestring_intern_pool::intern(const std::string& input)
+  {
+    return lookup(input.data(), input.length()).str;
+  }
+
+  runestring_intern_pool::symbol_type runestring_intern_pool::symbol(
+    const runestring& str
+  )
+  {
+    return lookup(str).symbol;
+  }
+
+  runestring_intern_pool::symbol_type runestring_intern_pool::symbol(
+    const char* input
+  )
+  {
+    return lookup(input, input ? std::strlen(input) : 0).symbol;
+  }
+
+  runestring_intern_pool::symbol_type runestring_intern_pool::symbol(
+    const char* input,
+    size_type size
+  )
+  {
+    return lookup(input, size).symbol;
+  }
+
+  runestring_intern_pool::symbol_type runestring_intern_pool::symbol(
+    const std::string& input
+  )
+  {
+    return lookup(input.data(), input.length()).symbol;
+  }
+
+  runestring runestring_intern_pool::str(symbol_type symbol) const
+  {
+    const shard& s = *m_shards[symbol & ((1u << m_shard_bits) - 1)];
+    const size_type index = symbol >> m_shard_bits;
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    if (index >= s.entries.size())
+    {
+      throw std::out_of_range("unknown symbol");
+    }
+
+    return s.entries[index].str;
+  }
+
+  /**
+   * Encodes key of given string into given byte string. The key is the
+   * UTF-8 encoding of the string, which is what valid UTF-8 input consists
+   * of. Strings containing runes which cannot be encoded with UTF-8 are
+   * keyed by a 0xff byte followed by their code points in UTF-32LE, which
+   * never collides with UTF-8.
+   */
+  static void encode_key(const runestring& str, std::string& key)
+  {
+    const runestring::size_type length = str.length();
+    char buffer[4];
+    std::size_t size;
+
+    key.clear();
+    for (runestring::size_type i = 0; i < length; ++i)
+    {
+      if (!utf8_encode(buffer, size, str[i].code()))
+      {
+        key.assign(1, '\xff');
+        for (i = 0; i < length; ++i)
+        {
+          const rune::value_type c = str[i].code();
+
+          key.push_back(static_cast<char>(c & 0xff));
+          key.push_back(static_cast<char>((c >> 8) & 0xff));
+          key.push_back(static_cast<char>((c >> 16) & 0xff));
+          key.push_back(static_cast<char>(c >> 24));
+        }
+
+        return;
+      }
+      key.append(buffer, size);
+    }
+  }
+
+  const runestring_intern_pool::entry& runestring_intern_pool::lookup(
+    const runestring& str
+  )
+  {
+    // Reused between lookups, so that encoding the key does not allocate.
+    static thread_local std::string key;
+
+    encode_key(str, key);
+
+    return insert(
+      key.data(),
+      key.length(),
+      hash_bytes(key.data(), key.length()),
+      str
+    );
+  }
+
+  const runestring_intern_pool::entry& runestring_intern_pool::lookup(
+    const char* input,
+    size_type size
+  )
+  {
+    const std::size_t hash = hash_bytes(input, size);
+    const shard& s = *m_shards[hash & ((size_type(1) << m_shard_bits) - 1)];
+
+    // Input which is found as it is equals the canonical key of an entry.
+    // Keys of strings which cannot be encoded with UTF-8 begin with a byte
+    // that is never valid UTF-8, so such input is not looked up directly.
+    if (!size || static_cast<unsigned char>(input[0]) != 0xff)
+    {
+      std::lock_guard<std::mutex> lock(s.mutex);
+      const entry* found = s.find(input, size, hash);
+
+      if (found)
+      {
+        return *found;
+      }
+    }
+
+    // Otherwise the input is decoded and looked up by the canonical encoding
+    // of the result, so that overlong sequences and anything following an
+    // invalid sequence do not produce entries of their own.
+    {
+      // Entries outlive any request scoped resource of the calling thread.
+      const memory_resource_scope scope(new_delete_resource());
+
+      return lookup(runestring(input, size));
+    }
+  }
+
+  const runestring_intern_pool::entry& runestring_intern_pool::insert(
+    const char* input,
+    size_type size,
+    std::size_t hash,
+    const runestring& str
+  )
+  {
+    const size_type index = hash & ((size_type(1) << m_shard_bits) - 1);
+    shard& s = *m_shards[index];
+    std::lock_guard<std::mutex> lock(s.mutex);
+    const entry* found = s.find(input, size, hash);
+
+    if (found)
+    {
+      return *found;
+    }
+    else if (s.entries.size() >= (size_type(0xffffffff) >> m_shard_bits))
+    {
+      throw std::length_error("intern pool has run out of symbols");
+    } else {
+      entry e = {
+        hash,
+        std::string(input, size),
+        pooled(str),
+        static_cast<symbol_type>((s.entries.size() << m_shard_bits) | index)
+      };
+
+      return s.add(std::move(e));
+    }
+  }
+}
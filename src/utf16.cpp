@@ -0,0 +1,35 @@
+#include <peelo/text/rune.hpp>
+
+namespace peelo
+{
+  bool utf16_encode(char* out,
+                    std::size_t& size,
+                    rune::value_type c,
+                    bool big_endian)
+  {
+    const int high = big_endian ? 0 : 1;
+    const int low = big_endian ? 1 : 0;
+
+    if (c > rune::max.code())
+    {
+      return false;
+    }
+    else if (c > 0xffff)
+    {
+      const rune::value_type lead = 0xd800 + ((c - 0x10000) >> 10);
+      const rune::value_type trail = 0xdc00 + ((c - 0x10000) & 0x3ff);
+
+      out[high] = static_cast<char>(lead >> 8);
+      out[low] = static_cast<char>(lead & 0xff);
+      out[2 + high] = static_cast<char>(trail >> 8);
+      out[2 + low] = static_cast<char>(trail & 0xff);
+      size = 4;
+    } else {
+      out[high] = static_cast<char>(c >> 8);
+      out[low] = static_cast<char>(c & 0xff);
+      size = 2;
+    }
+
+    return true;
+  }
+}
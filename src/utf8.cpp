@@ -72,4 +72,151 @@ namespace peelo
       return 0;
     }
   }
+
+  /**
+   * Decodes single UTF-8 sequence from given input. Returns number of bytes
+   * consumed by the sequence or zero if the input does not begin with a
+   * valid sequence.
+   */
+  static inline std::size_t utf8_decode_one(const char* input,
+                                            std::size_t size,
+                                            rune::value_type& result)
+  {
+    const std::size_t length = utf8_decode_size(input[0]);
+
+    if (!length || length > size)
+    {
+      return 0;
+    }
+    switch (length)
+    {
+      case 1:
+        result = input[0];
+        return 1;
+
+      case 2:
+        result = input[0] & 0x1f;
+        break;
+
+      case 3:
+        result = input[0] & 0x0f;
+        break;
+
+      case 4:
+        result = input[0] & 0x07;
+        break;
+
+      case 5:
+        result = input[0] & 0x03;
+        break;
+
+      case 6:
+        result = input[0] & 0x01;
+        break;
+    }
+    for (std::size_t i = 1; i < length; ++i)
+    {
+      if ((input[i] & 0xc0) != 0x80)
+      {
+        return 0;
+      }
+      result = (result << 6) | (input[i] & 0x3f);
+    }
+    if (result > rune::max.code())
+    {
+      return 0;
+    }
+
+    return length;
+  }
+
+  std::size_t utf8_count_runes(const char* input,
+                               std::size_t size,
+                               std::size_t& consumed,
+                               rune::value_type& max_code)
+  {
+    std::size_t count = 0;
+    std::size_t offset = 0;
+
+    max_code = 0;
+    while (offset < size)
+    {
+      rune::value_type code;
+      const std::size_t length = utf8_decode_one(
+        input + offset,
+        size - offset,
+        code
+      );
+
+      if (!length)
+      {
+        break;
+      }
+      else if (code > max_code)
+      {
+        max_code = code;
+      }
+      offset += length;
+      ++count;
+    }
+    consumed = offset;
+
+    return count;
+  }
+
+  std::size_t utf8_decode_next(const char* input,
+                               std::size_t size,
+                               rune::value_type& result)
+  {
+    return utf8_decode_one(input, size, result);
+  }
+
+  template<class T>
+  static std::size_t utf8_decode_into(const char* input,
+                                      std::size_t size,
+                                      T* output)
+  {
+    std::size_t count = 0;
+    std::size_t offset = 0;
+
+    while (offset < size)
+    {
+      rune::value_type code;
+      const std::size_t length = utf8_decode_one(
+        input + offset,
+        size - offset,
+        code
+      );
+
+      if (!length)
+      {
+        break;
+      }
+      output[count++] = static_cast<T>(code);
+      offset += length;
+    }
+
+    return count;
+  }
+
+  std::size_t utf8_decode_runes(const char* input,
+                                std::size_t size,
+                                std::uint8_t* output)
+  {
+    return utf8_decode_into(input, size, output);
+  }
+
+  std::size_t utf8_decode_runes(const char* input,
+                                std::size_t size,
+                                std::uint16_t* output)
+  {
+    return utf8_decode_into(input, size, output);
+  }
+
+  std::size_t utf8_decode_runes(const char* input,
+                                std::size_t size,
+                                std::uint32_t* output)
+  {
+    return utf8_decode_into(input, size, output);
+  }
 }
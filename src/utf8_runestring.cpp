@@ -0,0 +1,683 @@
+/*
+ * Copyright (c) 2016, peelo.net
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * * Redistributions of source code must retain the above copyright notice, this
+ *   list of conditions and the following disclaimer.
+ *
+ * * Redistributions in binary form must reproduce the above copyright notice,
+ *   this list of conditions and the following disclaimer in the documentation
+ *   and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+ * SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+ * CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+ * OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <peelo/text/utf8_runestring.hpp>
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+
+namespace peelo
+{
+  bool utf8_encode(char*, std::size_t&, rune::value_type);
+  std::size_t utf8_decode_size(char);
+  std::size_t utf8_decode_next(const char*, std::size_t, rune::value_type&);
+
+  const utf8_runestring::size_type utf8_runestring::npos(-1);
+
+  /**
+   * Returns length of the shortest UTF-8 sequence which encodes given code
+   * point.
+   */
+  static inline std::size_t shortest_sequence_size(rune::value_type code)
+  {
+    if (code < 0x80)
+    {
+      return 1;
+    }
+    else if (code < 0x800)
+    {
+      return 2;
+    }
+    else if (code < 0x10000)
+    {
+      return 3;
+    } else {
+      return 4;
+    }
+  }
+
+  /**
+   * Bytes of UTF-8 rune string, shared by it's copies and substrings,
+   * together with the sparse index which is built on first use.
+   */
+  struct utf8_runestring::storage
+  {
+    /** Number of runes between two indexed byte offsets. */
+    static const size_type interval = 64;
+
+    /** The UTF-8 encoded bytes. */
+    const std::string bytes;
+    /** Used to build the index only once. */
+    std::once_flag indexed;
+    /** Byte offsets of every <code>interval</code>th rune. */
+    std::vector<size_type> index;
+    /** Number of runes in the valid part of the bytes. */
+    size_type length;
+    /** Number of bytes which form valid UTF-8. */
+    size_type size;
+    /**
+     * Whether every rune in the valid part of the bytes is encoded with the
+     * shortest possible sequence.
+     */
+    bool canonical;
+
+    explicit storage(std::string&& input)
+      : bytes(std::move(input))
+      , length(0)
+      , size(0)
+      , canonical(true) {}
+
+    void build()
+    {
+      size_type offset = 0;
+      size_type count = 0;
+
+      index.push_back(0);
+      while (offset < bytes.size())
+      {
+        rune::value_type code;
+        const size_type sequence = utf8_decode_next(
+          bytes.data() + offset,
+          bytes.size() - offset,
+          code
+        );
+
+        if (!sequence)
+        {
+          break;
+        }
+        else if (sequence != shortest_sequence_size(code))
+        {
+          canonical = false;
+        }
+        offset += sequence;
+        if (++count % interval == 0)
+        {
+          index.push_back(offset);
+        }
+      }
+      length = count;
+      size = offset;
+    }
+
+    /**
+     * Builds the index unless it has been built already.
+     */
+    inline void ensure_index()
+    {
+      std::call_once(indexed, &storage::build, this);
+    }
+
+    /**
+     * Returns byte offset of rune in given position.
+     */
+    size_type offset_of(size_type pos)
+    {
+      size_type offset;
+
+      ensure_index();
+      if (pos >= length)
+      {
+        return size;
+      }
+      offset = index[pos / interval];
+      for (size_type i = pos % interval; i > 0; --i)
+      {
+        offset += utf8_decode_size(bytes[offset]);
+      }
+
+      return offset;
+    }
+
+    /**
+     * Returns position of rune which begins from given byte offset.
+     */
+    size_type position_of(size_type offset)
+    {
+      std::vector<size_type>::const_iterator block;
+      size_type pos;
+      size_type current;
+
+      ensure_index();
+      block = std::upper_bound(index.begin(), index.end(), offset) - 1;
+      pos = (block - index.begin()) * interval;
+      for (current = *block; current < offset; ++pos)
+      {
+        current += utf8_decode_size(bytes[current]);
+      }
+
+      return pos;
+    }
+  };
+
+  /**
+   * Decodes rune from given position of valid UTF-8 input.
+   */
+  static rune decode_rune(const char* input)
+  {
+    rune::value_type code = 0;
+
+    utf8_decode_next(input, utf8_decode_size(*input), code);
+
+    return rune(code);
+  }
+
+  /**
+   * Compares runes of two strings lexicographically, after converting their
+   * code points with given function.
+   */
+  template<class Function>
+  static int compare_runes(const utf8_runestring& a,
+                           const utf8_runestring& b,
+                           const Function& convert)
+  {
+    const utf8_runestring::iterator end1 = a.end();
+    const utf8_runestring::iterator end2 = b.end();
+    utf8_runestring::iterator i1 = a.begin();
+    utf8_runestring::iterator i2 = b.begin();
+
+    for (; i1 != end1 && i2 != end2; ++i1, ++i2)
+    {
+      const rune::value_type c1 = convert((*i1).code());
+      const rune::value_type c2 = convert((*i2).code());
+
+      if (c1 > c2)
+      {
+        return 1;
+      }
+      else if (c1 < c2)
+      {
+        return -1;
+      }
+    }
+    if (i1 != end1)
+    {
+      return 1;
+    }
+    else if (i2 != end2)
+    {
+      return -1;
+    } else {
+      return 0;
+    }
+  }
+
+  /**
+   * Returns given code point unchanged.
+   */
+  static inline rune::value_type same_code(rune::value_type code)
+  {
+    return code;
+  }
+
+  /**
+   * Returns given code point converted into lower case.
+   */
+  static inline rune::value_type lower_code(rune::value_type code)
+  {
+    return rune::to_lower(code);
+  }
+
+  utf8_runestring::utf8_runestring()
+    : m_offset(0)
+    , m_length(0) {}
+
+  utf8_runestring::utf8_runestring(const std::string& input)
+    : utf8_runestring(std::string(input)) {}
+
+  utf8_runestring::utf8_runestring(std::string&& input)
+    : m_storage(std::make_shared<storage>(std::move(input)))
+    , m_offset(0)
+    , m_length(npos) {}
+
+  utf8_runestring::utf8_runestring(const char* input)
+    : utf8_runestring(std::string(input ? input : "")) {}
+
+  utf8_runestring::utf8_runestring(const char* input, size_type size)
+    : utf8_runestring(std::string(input, size)) {}
+
+  utf8_runestring::utf8_runestring(const runestring& str)
+    : utf8_runestring(str.utf8()) {}
+
+  bool utf8_runestring::empty() const
+  {
+    return !length();
+  }
+
+  utf8_runestring::size_type utf8_runestring::length() const
+  {
+    if (m_length != npos)
+    {
+      return m_length;
+    }
+    m_storage->ensure_index();
+
+    return m_storage->length - m_offset;
+  }
+
+  utf8_runestring::size_type utf8_runestring::begin_offset() const
+  {
+    return m_offset ? m_storage->offset_of(m_offset) : 0;
+  }
+
+  utf8_runestring::size_type utf8_runestring::end_offset() const
+  {
+    if (m_length == npos)
+    {
+      m_storage->ensure_index();
+
+      return m_storage->size;
+    }
+    else if (!m_length)
+    {
+      return begin_offset();
+    }
+
+    return m_storage->offset_of(m_offset + m_length);
+  }
+
+  bool utf8_runestring::canonical() const
+  {
+    if (!m_storage)
+    {
+      return true;
+    }
+    m_storage->ensure_index();
+
+    return m_storage->canonical;
+  }
+
+  utf8_runestring::size_type utf8_runestring::size() const
+  {
+    return end_offset() - begin_offset();
+  }
+
+  const char* utf8_runestring::data() const
+  {
+    return m_storage ? m_storage->bytes.data() + begin_offset() : "";
+  }
+
+  utf8_runestring::value_type utf8_runestring::front() const
+  {
+    if (empty())
+    {
+      throw std::out_of_range("string is empty");
+    }
+
+    return (*this)[0];
+  }
+
+  utf8_runestring::value_type utf8_runestring::back() const
+  {
+    if (empty())
+    {
+      throw std::out_of_range("string is empty");
+    }
+
+    return *--end();
+  }
+
+  utf8_runestring::value_type utf8_runestring::at(size_type pos) const
+  {
+    if (pos < length())
+    {
+      return (*this)[pos];
+    }
+
+    throw std::out_of_range("index out of bounds");
+  }
+
+  utf8_runestring::value_type utf8_runestring::operator[](
+    size_type pos
+  ) const
+  {
+    return decode_rune(
+      m_storage->bytes.data() + m_storage->offset_of(m_offset + pos)
+    );
+  }
+
+  utf8_runestring::iterator utf8_runestring::begin() const
+  {
+    iterator i;
+
+    i.m_pointer = data();
+
+    return i;
+  }
+
+  utf8_runestring::iterator utf8_runestring::end() const
+  {
+    iterator i;
+
+    i.m_pointer = data() + size();
+
+    return i;
+  }
+
+  bool utf8_runestring::equals(const utf8_runestring& that) const
+  {
+    if (!canonical() || !that.canonical())
+    {
+      return !compare_runes(*this, that, same_code);
+    } else {
+      const size_type size = this->size();
+
+      return size == that.size() && !std::memcmp(data(), that.data(), size);
+    }
+  }
+
+  bool utf8_runestring::equals_icase(const utf8_runestring& that) const
+  {
+    return !compare_icase(that);
+  }
+
+  int utf8_runestring::compare(const utf8_runestring& that) const
+  {
+    size_type a;
+    size_type b;
+    int result;
+
+    if (!canonical() || !that.canonical())
+    {
+      return compare_runes(*this, that, same_code);
+    }
+    // Byte order of UTF-8 is the same as order of the code points, as long
+    // as the code points are encoded with the shortest sequences.
+    a = size();
+    b = that.size();
+    result = std::memcmp(data(), that.data(), std::min(a, b));
+    if (result > 0 || (!result && a > b))
+    {
+      return 1;
+    }
+    else if (result < 0 || (!result && a < b))
+    {
+      return -1;
+    } else {
+      return 0;
+    }
+  }
+
+  int utf8_runestring::compare_icase(const utf8_runestring& that) const
+  {
+    return compare_runes(*this, that, lower_code);
+  }
+
+  utf8_runestring utf8_runestring::substr(size_type pos, size_type count) const
+  {
+    const size_type length = this->length();
+    utf8_runestring result;
+
+    if (pos >= length)
+    {
+      return result;
+    }
+    else if (count == npos || count + pos > length)
+    {
+      count = length - pos;
+    }
+    result.m_storage = m_storage;
+    result.m_offset = m_offset + pos;
+    result.m_length = count;
+
+    return result;
+  }
+
+  utf8_runestring::size_type utf8_runestring::find(
+    const utf8_runestring& str,
+    size_type pos
+  ) const
+  {
+    const size_type length = this->length();
+
+    if (str.empty())
+    {
+      return pos;
+    }
+    else if (pos >= length)
+    {
+      return npos;
+    }
+    else if (!canonical() || !str.canonical())
+    {
+      // Overlong sequences must be matched by their runes, not bytes.
+      const utf8_runestring haystack = substr(pos);
+      const iterator found = std::search(
+        haystack.begin(),
+        haystack.end(),
+        str.begin(),
+        str.end()
+      );
+
+      if (found == haystack.end())
+      {
+        return npos;
+      }
+
+      return pos + std::distance(haystack.begin(), found);
+    } else {
+      const char* begin = data();
+      const char* end = begin + size();
+      const char* found = std::search(
+        m_storage->bytes.data() + m_storage->offset_of(m_offset + pos),
+        end,
+        str.data(),
+        str.data() + str.size()
+      );
+
+      if (found == end)
+      {
+        return npos;
+      }
+
+      return m_storage->position_of(found - m_storage->bytes.data())
+        - m_offset;
+    }
+  }
+
+  utf8_runestring::size_type utf8_runestring::find(const_reference needle,
+                                                   size_type pos) const
+  {
+    char buffer[4];
+    std::size_t size;
+
+    if (!utf8_encode(buffer, size, needle.code()))
+    {
+      // Runes such as surrogates are decoded from UTF-8 but not encoded
+      // into it, so they can only be matched by their code points.
+      const utf8_runestring haystack = substr(pos);
+      const iterator found = std::find(
+        haystack.begin(),
+        haystack.end(),
+        needle
+      );
+
+      if (found == haystack.end())
+      {
+        return npos;
+      }
+
+      return pos + std::distance(haystack.begin(), found);
+    }
+
+    return find(utf8_runestring(buffer, size), pos);
+  }
+
+  utf8_runestring::size_type utf8_runestring::rfind(
+    const utf8_runestring& str,
+    size_type pos
+  ) const
+  {
+    const size_type length = this->length();
+    const size_type count = str.length();
+
+    if (count > length)
+    {
+      return npos;
+    }
+    else if (pos == npos || pos > length - count)
+    {
+      pos = length - count;
+    }
+    if (!count)
+    {
+      return pos;
+    }
+    else if (!canonical() || !str.canonical())
+    {
+      // Overlong sequences must be matched by their runes, not bytes.
+      const utf8_runestring haystack = substr(0, pos + count);
+      const iterator found = std::find_end(
+        haystack.begin(),
+        haystack.end(),
+        str.begin(),
+        str.end()
+      );
+
+      if (found == haystack.end())
+      {
+        return npos;
+      }
+
+      return std::distance(haystack.begin(), found);
+    } else {
+      const char* begin = data();
+      const char* end = std::min(
+        m_storage->bytes.data()
+          + m_storage->offset_of(m_offset + pos)
+          + str.size(),
+        begin + size()
+      );
+      const char* found = std::find_end(
+        begin,
+        end,
+        str.data(),
+        str.data() + str.size()
+      );
+
+      if (found == end)
+      {
+        return npos;
+      }
+
+      return m_storage->position_of(found - m_storage->bytes.data())
+        - m_offset;
+    }
+  }
+
+  utf8_runestring::size_type utf8_runestring::rfind(const_reference needle,
+                                                    size_type pos) const
+  {
+    char buffer[4];
+    std::size_t size;
+
+    if (!utf8_encode(buffer, size, needle.code()))
+    {
+      // Runes such as surrogates are decoded from UTF-8 but not encoded
+      // into it, so they can only be matched by their code points.
+      const utf8_runestring haystack = substr(
+        0,
+        pos == npos ? npos : pos + 1
+      );
+      const iterator found = std::find_end(
+        haystack.begin(),
+        haystack.end(),
+        &needle,
+        &needle + 1
+      );
+
+      if (found == haystack.end())
+      {
+        return npos;
+      }
+
+      return std::distance(haystack.begin(), found);
+    }
+
+    return rfind(utf8_runestring(buffer, size), pos);
+  }
+
+  std::string utf8_runestring::utf8() const
+  {
+    return std::string(data(), size());
+  }
+
+  runestring utf8_runestring::runes() const
+  {
+    return runestring(data(), size());
+  }
+
+  utf8_runestring::iterator::iterator()
+    : m_pointer(nullptr) {}
+
+  utf8_runestring::value_type utf8_runestring::iterator::operator*() const
+  {
+    return decode_rune(m_pointer);
+  }
+
+  utf8_runestring::iterator& utf8_runestring::iterator::operator++()
+  {
+    m_pointer += utf8_decode_size(*m_pointer);
+
+    return *this;
+  }
+
+  utf8_runestring::iterator utf8_runestring::iterator::operator++(int)
+  {
+    iterator return_value(*this);
+
+    ++*this;
+
+    return return_value;
+  }
+
+  utf8_runestring::iterator& utf8_runestring::iterator::operator--()
+  {
+    do
+    {
+      --m_pointer;
+    }
+    while ((*m_pointer & 0xc0) == 0x80);
+
+    return *this;
+  }
+
+  utf8_runestring::iterator utf8_runestring::iterator::operator--(int)
+  {
+    iterator return_value(*this);
+
+    --*this;
+
+    return return_value;
+  }
+
+  std::ostream& operator<<(std::ostream& os, const utf8_runestring& str)
+  {
+    os.write(str.data(), str.size());
+
+    return os;
+  }
+}
@@ -0,0 +1,146 @@
+#include <peelo/text/batch_loader.hpp>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+#include <dirent.h>
+#include <unistd.h>
+
+using peelo::batch_loader;
+using peelo::runestring;
+
+static std::string write_temporary_file(const std::string& contents)
+{
+  char path[] = "/tmp/test_batch_loader_XXXXXX";
+  const int fd = ::mkstemp(path);
+  ssize_t written;
+
+  assert(fd >= 0);
+  written = ::write(fd, contents.data(), contents.size());
+  assert(written == static_cast<ssize_t>(contents.size()));
+  ::close(fd);
+
+  return path;
+}
+
+static std::size_t count_open_files()
+{
+  DIR* dir = ::opendir("/proc/self/fd");
+  std::size_t result = 0;
+
+  assert(dir);
+  while (::readdir(dir))
+  {
+    ++result;
+  }
+  ::closedir(dir);
+
+  return result;
+}
+
+static void test_loader(bool io_uring,
+                        std::vector<std::string> paths,
+                        const std::vector<std::string>& contents)
+{
+  batch_loader budgeted(8, 4096);
+  batch_loader loader(4);
+  batch_loader unbounded;
+  std::vector<runestring> result;
+  std::size_t callbacks = 0;
+  std::size_t open_files;
+  bool thrown = false;
+
+  budgeted.set_io_uring_enabled(io_uring);
+  loader.set_io_uring_enabled(io_uring);
+  unbounded.set_io_uring_enabled(io_uring);
+  if (!io_uring)
+  {
+    assert(!loader.uses_io_uring());
+  }
+
+  // Memory budget small enough to hold back some of the reads.
+  result = budgeted.load(paths);
+  assert(result.size() == paths.size());
+  for (std::size_t i = 0; i < paths.size(); ++i)
+  {
+    assert(result[i] == runestring(contents[i].c_str()));
+  }
+
+  paths.push_back("/nonexistent/test_batch_loader");
+  loader.load(paths, [&](std::size_t index,
+                         const runestring& str,
+                         const std::error_code& error)
+  {
+    ++callbacks;
+    if (index == paths.size() - 1)
+    {
+      assert(error);
+    } else {
+      assert(!error);
+      assert(str == runestring(contents[index].c_str()));
+    }
+  });
+  assert(callbacks == paths.size());
+
+  try
+  {
+    unbounded.load(paths);
+  }
+  catch (const std::system_error&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+
+  // Exception thrown by the callback stops the load, and no files are left
+  // open.
+  open_files = count_open_files();
+  callbacks = 0;
+  thrown = false;
+  try
+  {
+    budgeted.load(paths, [&](std::size_t,
+                             const runestring&,
+                             const std::error_code&)
+    {
+      if (++callbacks == 3)
+      {
+        throw std::runtime_error("stop");
+      }
+    });
+  }
+  catch (const std::runtime_error&)
+  {
+    thrown = true;
+  }
+  assert(thrown && callbacks == 3);
+  assert(count_open_files() == open_files);
+}
+
+int main()
+{
+  std::vector<std::string> paths;
+  std::vector<std::string> contents;
+
+  for (int i = 0; i < 100; ++i)
+  {
+    contents.push_back(
+      std::string(i * 37, 'a') + "\xc3\xa4" + char('0' + i % 10)
+    );
+    paths.push_back(write_temporary_file(contents.back()));
+  }
+  paths.push_back(write_temporary_file(""));
+  contents.push_back("");
+
+  test_loader(true, paths, contents);
+  test_loader(false, paths, contents);
+
+  for (const auto& path : paths)
+  {
+    std::remove(path.c_str());
+  }
+
+  return 0;
+}
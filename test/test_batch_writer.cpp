@@ -0,0 +1,88 @@
+#include <peelo/text/batch_writer.hpp>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+using peelo::batch_writer;
+using peelo::runestring;
+
+static std::string read_file(int fd)
+{
+  std::string result;
+  char buffer[4096];
+  ssize_t size;
+
+  ::lseek(fd, 0, SEEK_SET);
+  while ((size = ::read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    result.append(buffer, size);
+  }
+
+  return result;
+}
+
+int main()
+{
+  char path[] = "/tmp/test_batch_writer_XXXXXX";
+  const int fd = ::mkstemp(path);
+  std::vector<runestring> items;
+  std::vector<std::size_t> written;
+  std::string expected;
+  std::size_t size;
+  int status;
+
+  assert(fd >= 0);
+  for (int i = 0; i < 1000; ++i)
+  {
+    const std::string item = std::string(i % 7, 'a') + "\xc3\xa4\xe5\x81\x87";
+
+    items.push_back(runestring(item.c_str()));
+    if (i > 0)
+    {
+      expected += ", ";
+    }
+    expected += item + "\n";
+  }
+
+  // Tiny segments, so that items are split across segments and several
+  // writes are needed.
+  size = batch_writer(5, 3).write(fd, items, ", ", "\n", &written);
+  assert(size == expected.size());
+  assert(read_file(fd) == expected);
+  assert(written.size() == items.size());
+  assert(written[0] == 6);
+  assert(written[1] == 9);
+
+  size = batch_writer().write_at(fd, 2, items);
+  assert(size > 0);
+  assert(read_file(fd).substr(0, 8) == "\xc3\xa4\xc3\xa4\xe5\x81\x87" "a");
+
+  // Writer can be reused after a failed write, even though segments were
+  // shrunk when runes did not fit into them.
+  {
+    batch_writer writer(4, 8);
+    const std::vector<runestring> ascii(100, runestring("xxxx"));
+
+    try
+    {
+      writer.write(-1, items, ", ", "\n");
+      assert(false);
+    }
+    catch (const std::system_error&) {}
+    status = ::ftruncate(fd, 0);
+    assert(status == 0);
+    ::lseek(fd, 0, SEEK_SET);
+    size = writer.write(fd, ascii);
+    assert(size == 400);
+    assert(read_file(fd) == std::string(400, 'x'));
+  }
+
+  ::close(fd);
+  std::remove(path);
+
+  return 0;
+}
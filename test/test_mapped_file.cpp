@@ -0,0 +1,85 @@
+#include <peelo/text/mapped_file.hpp>
+#include <peelo/text/runestring.hpp>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+using peelo::mapped_file;
+using peelo::rune;
+using peelo::runestring;
+
+static std::string write_temporary_file(const std::string& contents)
+{
+  char path[] = "/tmp/test_mapped_file_XXXXXX";
+  const int fd = ::mkstemp(path);
+  ssize_t written;
+
+  assert(fd >= 0);
+  written = ::write(fd, contents.data(), contents.size());
+  assert(written == static_cast<ssize_t>(contents.size()));
+  ::close(fd);
+
+  return path;
+}
+
+int main()
+{
+  const std::string empty_path = write_temporary_file("");
+  const std::string path = write_temporary_file("a\xc3\xa4\xe5\x81\x87z");
+  std::string large;
+  bool thrown = false;
+
+  {
+    mapped_file file(path);
+
+    assert(file.size() == 7);
+    assert(file.data()[0] == 'a');
+    file.release(0, file.size());
+    assert(file.data()[6] == 'z');
+    file.close();
+    assert(file.empty());
+  }
+
+  assert(mapped_file(empty_path).empty());
+  assert(runestring::from_file(empty_path).empty());
+
+  assert(runestring::from_file(path) == "a\xc3\xa4\xe5\x81\x87z");
+  assert(runestring::from_file(path).length() == 4);
+
+  // Large enough to be decoded in several windows.
+  for (int i = 0; i < 3 * 1024 * 1024; ++i)
+  {
+    large += i % 3 ? "a" : "\xe5\x81\x87";
+  }
+  large += "\xff";
+  std::remove(path.c_str());
+  {
+    const std::string large_path = write_temporary_file(large);
+    const runestring str = runestring::from_file(large_path);
+
+    assert(str.length() == 3 * 1024 * 1024);
+    assert(str == runestring(large.c_str()));
+    std::remove(large_path.c_str());
+  }
+
+  assert(runestring("a\0b", 3).length() == 3);
+  assert(runestring("a\xc3", 2) == "a");
+
+  try
+  {
+    runestring::from_file(path);
+  }
+  catch (const std::system_error&)
+  {
+    thrown = true;
+  }
+  assert(thrown);
+
+  std::remove(empty_path.c_str());
+
+  return 0;
+}
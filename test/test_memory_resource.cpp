@@ -0,0 +1,101 @@
+#include <peelo/text/runestring.hpp>
+#include <cassert>
+#include <cstdint>
+
+using peelo::memory_resource;
+using peelo::memory_resource_scope;
+using peelo::monotonic_buffer_resource;
+using peelo::runestring;
+
+/**
+ * Resource which counts bytes that are currently allocated from it.
+ */
+class counting_resource : public memory_resource
+{
+public:
+  counting_resource()
+    : allocated(0) {}
+
+  std::size_t allocated;
+
+protected:
+  void* do_allocate(std::size_t bytes, std::size_t alignment)
+  {
+    allocated += bytes;
+
+    return peelo::new_delete_resource()->allocate(bytes, alignment);
+  }
+
+  void do_deallocate(void* p, std::size_t bytes, std::size_t alignment)
+  {
+    allocated -= bytes;
+    peelo::new_delete_resource()->deallocate(p, bytes, alignment);
+  }
+
+  bool do_is_equal(const memory_resource& that) const noexcept
+  {
+    return this == &that;
+  }
+};
+
+int main()
+{
+  const runestring text("first line of text\nsecond line of text\nthird");
+  counting_resource counter;
+
+  assert(peelo::get_default_resource() == peelo::new_delete_resource());
+  assert(text.resource() == peelo::new_delete_resource());
+  assert(runestring("abc").resource() == nullptr);
+
+  {
+    monotonic_buffer_resource arena(64, &counter);
+    void* a = arena.allocate(3, 1);
+    void* b = arena.allocate(16, 16);
+    void* c = arena.allocate(1000, 8);
+
+    assert(a && b && c);
+    assert(reinterpret_cast<std::uintptr_t>(b) % 16 == 0);
+    assert(reinterpret_cast<std::uintptr_t>(c) % 8 == 0);
+    assert(counter.allocated > 1000);
+    arena.release();
+    assert(counter.allocated == 0);
+    arena.allocate(10);
+    assert(counter.allocated > 0);
+  }
+  assert(counter.allocated == 0);
+
+  {
+    monotonic_buffer_resource arena(4096, &counter);
+    runestring kept;
+
+    {
+      const memory_resource_scope scope(&arena);
+      const runestring upper = text.to_upper();
+      const auto lines = upper.lines(&arena);
+
+      assert(peelo::get_default_resource() == &arena);
+      assert(upper.resource() == &arena);
+      assert(lines.size() == 3);
+      assert(lines[1] == "SECOND LINE OF TEXT");
+      assert(lines[1].resource() == &arena);
+      assert(text.words(&arena).size() == 9);
+      kept = lines[0].detach();
+    }
+    assert(peelo::get_default_resource() == peelo::new_delete_resource());
+    assert(kept == "FIRST LINE OF TEXT");
+    assert(kept.resource() == peelo::new_delete_resource());
+  }
+  assert(counter.allocated == 0);
+
+  {
+    const memory_resource_scope scope(&counter);
+    runestring str = text.concat(text);
+
+    assert(counter.allocated > 0);
+    str = std::move(str) + text;
+    str = runestring();
+    assert(counter.allocated == 0);
+  }
+
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <peelo/text/runerope.hpp>
+#include <cassert>
+#include <sstream>
+#include <string>
+
+using peelo::rune;
+using peelo::runerope;
+using peelo::runestring;
+
+int main()
+{
+  {
+    runerope rope;
+
+    assert(rope.empty() && rope.length() == 0);
+    assert(rope.line_count() == 1 && rope.line_of(0) == 0);
+    assert(rope.str().empty() && rope.utf8().empty());
+    rope.append(runestring("b\xc3\xa4r"));
+    rope.insert(0, runestring("foo\n"));
+    rope.append(runerope("\nbaz\xe2\x82\xac"));
+    assert(rope.length() == 12);
+    assert(rope.utf8() == "foo\nb\xc3\xa4r\nbaz\xe2\x82\xac");
+    assert(rope.str() == "foo\nb\xc3\xa4r\nbaz\xe2\x82\xac");
+    assert(rope.str().width() == 2);
+    assert(rope[5] == rune(0xe4) && rope.at(11) == rune(0x20ac));
+    assert(rope.line_count() == 3);
+    assert(rope.line_start(1) == 4 && rope.line_start(2) == 8);
+    assert(rope.line_of(3) == 0 && rope.line_of(4) == 1);
+    assert(rope.line_of(12) == 2);
+    assert(rope.substr(4, 3).str() == "b\xc3\xa4r");
+    rope.erase(3, 4);
+    assert(rope.str() == "foo\nbaz\xe2\x82\xac");
+  }
+
+  {
+    std::string text;
+    runestring expected;
+    runerope rope;
+    runerope snapshot;
+    std::ostringstream out;
+    unsigned long state = 1;
+
+    for (int i = 0; i < 5000; ++i)
+    {
+      text += i % 7 ? "line \xc3\xa4 " : "\xf0\x9f\x98\x80\n";
+    }
+    expected = runestring(text.c_str());
+    rope = runerope(expected);
+    snapshot = rope;
+    for (int i = 0; i < 2000; ++i)
+    {
+      runestring::size_type pos;
+
+      state = state * 1103515245 + 12345;
+      pos = (state >> 8) % (expected.length() + 1);
+      if (i % 3)
+      {
+        const runestring piece(i % 5 ? "x" : "ab\ncd");
+
+        rope.insert(pos, piece);
+        expected.insert(pos, piece);
+      } else {
+        rope.erase(pos, i % 50);
+        expected.erase(pos, i % 50);
+      }
+    }
+    assert(rope.length() == expected.length());
+    assert(rope.str() == expected);
+    assert(rope.utf8() == expected.utf8());
+    out << rope;
+    assert(out.str() == expected.utf8());
+    assert(snapshot.str() == runestring(text.c_str()));
+    for (runestring::size_type pos = 0; pos < expected.length(); pos += 97)
+    {
+      assert(rope[pos] == expected[pos]);
+      assert(rope.substr(pos, 10).str() == expected.substr(pos, 10));
+    }
+    for (runestring::size_type line = 1; line < rope.line_count(); ++line)
+    {
+      const runestring::size_type start = rope.line_start(line);
+
+      assert(expected[start - 1] == rune('\n'));
+      assert(rope.line_of(start) == line);
+      assert(rope.line_of(start - 1) == line - 1);
+    }
+  }
+
+  return 0;
+}
@@ -1,5 +1,13 @@
 #include <peelo/text/runestring.hpp>
 #include <cassert>
+#include <clocale>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 using peelo::rune;
 using peelo::runestring;
@@ -28,6 +36,492 @@ int main()
   assert(runestring("\xc3\x84").to_lower() == "\xc3\xa4");
   assert(runestring("a\xc3\x84").utf8() == "a\xc3\x84");
 
+  assert(runestring("\xf0\x9f\x98\x80").utf16_be()
+         == std::string("\xd8\x3d\xde\x00", 4));
+  assert(runestring("\xf0\x9f\x98\x80").utf16_le()
+         == std::string("\x3d\xd8\x00\xde", 4));
+  {
+    const runestring str("a\xc3\xa4\xf0\x9f\x98\x80" "b");
+    char buffer[8];
+    runestring::encode_result result;
+
+    result = str.encode_utf8_bounded(0, 4, buffer);
+    assert(result.runes == 2 && result.bytes == 3);
+    assert(std::string(buffer, result.bytes) == "a\xc3\xa4");
+    result = str.encode_utf8_bounded(2, 3, buffer);
+    assert(result.runes == 0 && result.bytes == 0);
+    result = str.encode_utf8_bounded(2, 8, buffer);
+    assert(result.runes == 2 && result.bytes == 5);
+    result = str.encode_utf16_be_bounded(1, 4, buffer);
+    assert(result.runes == 1 && result.bytes == 2);
+    result = str.encode_utf16_le_bounded(2, 6, buffer);
+    assert(result.runes == 2 && result.bytes == 6);
+    assert(std::string(buffer, 6) == std::string("\x3d\xd8\x00\xde" "b\0", 6));
+  }
+
+  {
+    const runestring small("abcdefghijkl");
+    const runestring large("abcdefghijklmnopqrst");
+    runestring copy;
+
+    assert(sizeof(runestring) == 16 || sizeof(void*) != 8);
+    assert(large.substr(0, 12) == small);
+    assert(large.substr(0, 13) == "abcdefghijklm");
+    assert(large.substr(0, 13) < large);
+    assert(large.substr(4).substr(1, 2) == "fg");
+    assert(small.concat(rune('m')) == large.substr(0, 13));
+    assert(small.concat(rune('m')).concat(small).length() == 25);
+    assert(small.end() - small.begin() == 12);
+    copy = large;
+    copy = small;
+    assert(copy == small && copy != large);
+    copy = copy;
+    assert(copy == small);
+    copy = large.substr(7);
+    assert(copy == "hijklmnopqrst" && copy.length() == 13);
+    assert(std::move(copy).trim() == "hijklmnopqrst");
+  }
+
+  {
+    const runestring latin1("abc\xc3\xa4");
+    const runestring bmp("abc\xe2\x82\xac");
+    const runestring astral("abc\xf0\x9f\x98\x80");
+    const rune wide[] = { rune('a'), rune('b'), rune(0x20ac) };
+    runestring str;
+
+    assert(latin1.width() == 1 && bmp.width() == 2 && astral.width() == 4);
+    assert(runestring(wide, 2).width() == 1);
+    assert(runestring(wide, 3).width() == 2);
+    assert(runestring(3, rune(0x1f600)).width() == 4);
+    assert(latin1.substr(0, 3) == bmp.substr(0, 3));
+    assert(astral.substr(0, 3) == latin1.substr(0, 3));
+    assert(bmp.substr(0, 3).compare(latin1) < 0);
+    assert(latin1 < bmp && bmp < astral);
+    assert(latin1.concat(bmp).width() == 2);
+    assert(latin1.concat(bmp) == "abc\xc3\xa4" "abc\xe2\x82\xac");
+    assert(latin1.concat(rune(0x1f600)).back() == rune(0x1f600));
+    assert(astral.find(latin1.substr(1, 2)) == 1);
+    assert(latin1.find(bmp.substr(3)) == runestring::npos);
+    assert(bmp.find(rune(0x20ac)) == 3);
+    assert(latin1.find(rune(0x20ac)) == runestring::npos);
+    assert(latin1.find(rune(0xe4)) == 3);
+    assert(latin1.find(wide, 0, 2) == 0);
+    assert(bmp.equals_icase("ABC\xe2\x82\xac"));
+    assert(latin1.utf8() == "abc\xc3\xa4");
+    assert(bmp.utf16_be() == std::string("\0a\0b\0c\x20\xac", 8));
+    assert(astral.utf32_le().size() == 16);
+    assert(*(bmp.begin() + 3) == rune(0x20ac));
+    assert(bmp.begin()->is_alpha());
+    assert(bmp.end() - bmp.begin() == 4);
+
+    // Upper case of y with diaeresis is outside of Latin-1.
+    str = runestring("abcdefghijklmnopqrstuvwxyz\xc3\xbf");
+    assert(str.width() == 1);
+    assert(str.to_upper().width() == 2);
+    assert(str.to_upper().back() == rune(0x178));
+    assert(str.to_upper().substr(0, 3) == "ABC");
+    assert(std::move(str).to_upper() == "ABCDEFGHIJKLMNOPQRSTUVWXYZ\xc5\xb8");
+    assert(runestring("\xc3\xbf").to_upper() == "\xc5\xb8");
+  }
+
+  {
+    const runestring original("ABCDEFGHIJ");
+    runestring copy(original);
+    runestring moved(std::move(copy));
+    runestring built;
+
+    assert(copy.empty());
+    assert(moved == original);
+    assert(std::move(moved).to_lower() == "abcdefghij");
+    assert(original == "ABCDEFGHIJ");
+    copy = original;
+    assert(std::move(copy).to_lower() == "abcdefghij");
+    assert(original == "ABCDEFGHIJ");
+    for (int i = 0; i < 100; ++i)
+    {
+      built = std::move(built) + rune('a' + i % 26);
+    }
+    assert(built.length() == 100);
+    assert(built.substr(26, 3) == "abc");
+    built = std::move(built) + original;
+    assert(built.substr(100) == original);
+    assert(runestring("  abcdefgh  ").trim() == "abcdefgh");
+    assert(runestring("  abc  ").trim() == "abc");
+    moved = runestring("abcdefghij");
+    moved = std::move(moved);
+    assert(moved == "abcdefghij");
+  }
+
+  {
+    const runestring document(std::string(1000, 'x').c_str());
+    runestring token = document.substr(10, 20);
+    runestring compacted;
+
+    assert(document.buffer_size() == 1000);
+    assert(document.use_count() == 2);
+    assert(token.buffer_size() == 1000);
+    assert(runestring("abc").buffer_size() == 0);
+    assert(runestring("abc").use_count() == 0);
+    compacted = token.compact();
+    assert(compacted == token);
+    assert(compacted.buffer_size() == 20 && compacted.use_count() == 1);
+    assert(document.compact().use_count() == 3);
+    token = runestring();
+    assert(document.use_count() == 1);
+
+    assert(runestring::retention_threshold() == 0.0);
+    runestring::set_retention_threshold(0.1);
+    assert(document.substr(0, 99).use_count() == 1);
+    assert(document.substr(0, 100).use_count() == 2);
+    assert(document.words()[0].buffer_size() == 1000);
+    assert(runestring(document).concat(rune(' ')).trim().length() == 1000);
+    runestring::set_retention_threshold(0.0);
+    assert(document.substr(0, 99).use_count() == 2);
+  }
+
+  {
+    const runestring ascii("abcdefghijklmnopqrst");
+    const runestring mixed("abcdefghijklmnopqrst\xe2\x82\xac");
+    runestring str;
+
+    assert(runestring().is_ascii() && runestring().max_code() == 0);
+    assert(runestring("abc").is_ascii());
+    assert(!runestring("\xc3\xa4").is_ascii());
+    assert(runestring("\xc3\xa4").is_latin1());
+    assert(ascii.is_ascii() && ascii.max_code() == 't');
+    assert(!mixed.is_latin1() && mixed.is_bmp());
+    assert(mixed.max_code() == 0x20ac);
+    assert(mixed.substr(0, 20).is_ascii());
+    assert(mixed.substr(0, 20).max_code() == 't');
+    assert(!runestring("\xf0\x9f\x98\x80").is_bmp());
+    assert(mixed.to_upper() == "ABCDEFGHIJKLMNOPQRST\xe2\x82\xac");
+    assert(ascii.equals_icase("ABCDEFGHIJKLMNOPQRST"));
+    assert(ascii.compare_icase(mixed.substr(0, 20).to_upper()) == 0);
+    assert(ascii.utf8() == "abcdefghijklmnopqrst");
+
+    assert(ascii.hash() == mixed.substr(0, 20).hash());
+    assert(ascii.hash() == runestring("abcdefghijklmnopqrst").hash());
+    assert(ascii.hash() == ascii.hash());
+    assert(runestring("abc").hash() == ascii.substr(0, 3).hash());
+    assert(runestring("abc").hash() != runestring("abd").hash());
+
+    str = runestring(ascii);
+    str = std::move(str) + rune('u');
+    str = ascii;
+    str = std::move(str).concat("u");
+    assert(str.hash() != ascii.hash());
+    str = std::move(str).concat(rune(0xe4));
+    assert(str.max_code() == 0xe4);
+    assert(str.hash() == runestring("abcdefghijklmnopqrstu\xc3\xa4").hash());
+    str = std::move(str).to_upper();
+    assert(str.max_code() == 0xc4);
+    assert(str.hash() == runestring("ABCDEFGHIJKLMNOPQRSTU\xc3\x84").hash());
+  }
+
+  {
+    runestring str;
+    runestring copy;
+    std::size_t capacity;
+
+    for (int i = 0; i < 100; ++i)
+    {
+      str.push_back(rune('a' + i % 26));
+    }
+    assert(str.length() == 100 && str.substr(26, 3) == "abc");
+    capacity = str.buffer_size();
+    assert(capacity >= 100 && str.use_count() == 1);
+    str.erase(0, 26).erase(50);
+    assert(str.length() == 50 && str.substr(0, 3) == "abc");
+    assert(str.buffer_size() == capacity);
+    str.insert(0, runestring("0123")).insert(2, rune('x'));
+    assert(str.substr(0, 8) == "01x23abc");
+    assert(str.buffer_size() == capacity);
+    str.set(0, rune('z'));
+    assert(str.front() == rune('z'));
+    copy = str;
+    str.set(1, rune('y'));
+    assert(copy.substr(0, 2) == "z1" && str.substr(0, 2) == "zy");
+    assert(copy.use_count() == 1 && str.use_count() == 1);
+    str.set(2, rune(0x20ac));
+    assert(str.width() == 2 && str.substr(0, 4) == "zy\xe2\x82\xac" "2");
+    str.append(str);
+    assert(str.length() == 110 && str.substr(55, 3) == "zy\xe2\x82\xac");
+    str.resize(3);
+    assert(str == "zy\xe2\x82\xac");
+    str.resize(5, rune('!'));
+    assert(str == "zy\xe2\x82\xac!!");
+    str += rune(0x1f600);
+    str += runestring("abc");
+    assert(str.width() == 4 && str.length() == 9);
+    str.erase();
+    assert(str.empty());
+
+    str = runestring("abcdefghijklmnopqrstuvwxyz");
+    copy = str;
+    str.make_upper();
+    assert(str == "ABCDEFGHIJKLMNOPQRSTUVWXYZ");
+    assert(copy == "abcdefghijklmnopqrstuvwxyz");
+    copy.make_upper().make_lower();
+    assert(copy == "abcdefghijklmnopqrstuvwxyz");
+    str = runestring("abc");
+    assert(str.insert(3, runestring("d")) == "abcd");
+  }
+
+  {
+    const runestring key("key");
+    const runestring value("\xe2\x82\xac" "value");
+    const runestring sep(":");
+    runestring str;
+    std::ostringstream out;
+
+    str = runestring::concatenate(key, sep, "\xc3\xa4", value, rune('!'));
+    assert(str == "key:\xc3\xa4\xe2\x82\xac" "value!");
+    assert(str.width() == 2);
+    assert(str.buffer_size() == 24 && str.use_count() == 1);
+    assert(runestring::concatenate().empty());
+    assert(runestring::concatenate("", runestring(), "").empty());
+    assert(runestring::concatenate(runestring("x"), "y", rune('z')) == "xyz");
+    str = key + sep + "\xc3\xa4" + value + rune('!');
+    assert(str == "key:\xc3\xa4\xe2\x82\xac" "value!");
+    assert((key + sep).length() == 4);
+    assert((key + sep).utf8() == "key:");
+    assert(key + sep < key + key);
+    assert(key + sep + key == "key:key");
+    assert(key + rune(0x1f600) != "key");
+    assert(("a" + key).width() == 1);
+    assert("prefix-" + key + "" == "prefix-key");
+    assert(runestring::format("{}!", key + sep) == "key:!");
+    out << key + sep + "\xc3\xa4" + rune('!');
+    assert(out.str() == "key:\xc3\xa4!");
+    str = runestring("x") + "yz";
+    assert(str == "xyz");
+    str = std::move(str) + "w" + key;
+    assert(str == "xyzwkey");
+
+    // Result of concatenation owns its runes, so it can be stored even when
+    // the operands were temporaries.
+    static_assert(
+      std::is_same<decltype(key + sep + "x" + rune('y')), runestring>::value,
+      "concatenation must produce rune string"
+    );
+    auto stored = key + runestring("tmp") + "\xc3\xa4";
+    assert(stored == "keytmp\xc3\xa4");
+  }
+
+  {
+    std::vector<runestring> fields;
+    runestring str;
+
+    assert(runestring::join(",", fields).empty());
+    assert(runestring::join_utf8(rune(','), fields).empty());
+    fields.push_back(runestring("abcdefghijklmnopqrst"));
+    str = runestring::join(rune(0x20ac), fields);
+    assert(str == fields[0] && str.use_count() == 2);
+    fields.push_back(runestring("\xc3\xa4"));
+    fields.push_back(runestring());
+    fields.push_back(runestring("\xf0\x9f\x98\x80"));
+    str = runestring::join(", ", fields);
+    assert(str == "abcdefghijklmnopqrst, \xc3\xa4, , \xf0\x9f\x98\x80");
+    assert(str.width() == 4 && str.buffer_size() == str.length() * 4);
+    assert(runestring::join(rune(0x20ac), fields.begin(), fields.begin() + 2)
+           == "abcdefghijklmnopqrst\xe2\x82\xac\xc3\xa4");
+    assert(runestring::join(runestring(), fields).length() == 22);
+    assert(runestring::join_utf8(", ", fields)
+           == "abcdefghijklmnopqrst, \xc3\xa4, , \xf0\x9f\x98\x80");
+    assert(runestring::join_utf8(rune(0x20ac), fields.begin() + 1,
+                                 fields.end())
+           == "\xc3\xa4\xe2\x82\xac\xe2\x82\xac\xf0\x9f\x98\x80");
+  }
+
+  {
+    runestring str("one two one three one");
+    runestring copy;
+    std::string text;
+
+    str.replace(0, 3, runestring("1"));
+    assert(str == "1 two one three one");
+    str.replace(2, 3, runestring("\xe2\x82\xac"));
+    assert(str == "1 \xe2\x82\xac one three one" && str.width() == 2);
+    str.replace(str.length() - 3, runestring::npos, str);
+    assert(str.length() == 31 && str.substr(14, 3) == "1 \xe2\x82\xac");
+
+    str = runestring("one two one three one");
+    copy = str;
+    str.replace_all("one", "1");
+    assert(str == "1 two 1 three 1" && copy == "one two one three one");
+    str.replace_all("missing", "x");
+    assert(str == "1 two 1 three 1");
+    str = runestring("abcabcabcabcabcabc");
+    str.replace_all("b", "\xf0\x9f\x98\x80");
+    assert(str.width() == 4 && str.length() == 18);
+    assert(str.substr(0, 3) == "a\xf0\x9f\x98\x80" "c");
+    str = runestring("aaaaaaaaaaaaaaaaaaaa");
+    str.replace_all("aa", "b");
+    assert(str == "bbbbbbbbbb");
+
+    str = runestring("the cat and the dog and the bird");
+    str.replace_all({
+      { runestring("the "), runestring() },
+      { runestring("cat"), runestring("dog") },
+      { runestring("dog"), runestring("cat") },
+      { runestring("and"), runestring("&") }
+    });
+    assert(str == "dog & cat & bird");
+
+    // Same length replacements of unique buffer are done in place.
+    for (int i = 0; i < 100; ++i)
+    {
+      text += "<a>";
+    }
+    str = runestring(text.c_str());
+    str.replace_all({
+      { runestring("<"), runestring("[") },
+      { runestring(">"), runestring("]") }
+    });
+    assert(str.substr(0, 6) == "[a][a]" && str.length() == 300);
+    assert(str.buffer_size() == 300 && str.use_count() == 1);
+    assert(str.find(rune('<')) == runestring::npos);
+  }
+
+  {
+    const runestring name("w\xc3\xb6rld");
+    runestring str = runestring::format(runestring("{1}, {0}!"), name, "Hi");
+
+    assert(str == "Hi, w\xc3\xb6rld!");
+    str = runestring::format(runestring("{0}, {0}, {0}"), name);
+    assert(str.length() == 19 && str.buffer_size() == 19);
+    assert(runestring::format(runestring("{} {} {{}}"), 1, 2) == "1 2 {}");
+    assert(runestring::format(runestring("[{:>5}]"), "ab") == "[   ab]");
+    assert(runestring::format(runestring("[{:*^6}]"), name) ==
+           "[w\xc3\xb6rld*]");
+    assert(runestring::format(runestring("[{:<4}]"), 42) == "[42  ]");
+    assert(runestring::format(runestring("[{:4}]"), 42) == "[  42]");
+    assert(runestring::format(runestring("[{:4}]"), true) == "[true]");
+    assert(runestring::format(runestring("{:.2}"), name) == "w\xc3\xb6");
+    assert(runestring::format(runestring("{:.2}"), "\xc3\xa4\xc3\xb6x") ==
+           "\xc3\xa4\xc3\xb6");
+    assert(runestring::format(runestring("{}"), std::string("abc")) == "abc");
+    assert(runestring::format(runestring("{:x}/{:X}"), 255, 255u) == "ff/FF");
+    assert(runestring::format(runestring("{:08b}"), 5) == "00000101");
+    assert(runestring::format(runestring("{:05}"), -42) == "-0042");
+    assert(runestring::format(runestring("{}"), -9223372036854775807LL - 1) ==
+           "-9223372036854775808");
+    assert(runestring::format(runestring("{} {}"), 0.1, 2.5) == "0.1 2.5");
+    assert(runestring::format(runestring("{:.3f}"), 3.14159) == "3.142");
+    assert(runestring::format(runestring("{:>7.2f}"), -1.5) == "  -1.50");
+    assert(runestring::format(runestring("{}{}"), rune('a'), 'b') == "ab");
+    static_assert(
+      !std::is_constructible<runestring::format_argument, int*>::value,
+      "pointers must not be formatted as booleans"
+    );
+    static_assert(
+      std::is_constructible<runestring::format_argument, char*>::value,
+      "mutable C strings must still be formatted as strings"
+    );
+
+    // Decimal point does not depend on the global locale.
+    for (const char* locale : { "de_DE.UTF-8", "de_DE.utf8", "fr_FR.UTF-8" })
+    {
+      if (std::setlocale(LC_NUMERIC, locale))
+      {
+        assert(runestring::format(runestring("{} {}"), 0.1, 2.5) == "0.1 2.5");
+        assert(runestring::format(runestring("{:.2f}"), 1.5) == "1.50");
+        assert(runestring::format(runestring("{:e}"), 1.5) == "1.500000e+00");
+        std::setlocale(LC_NUMERIC, "C");
+        break;
+      }
+    }
+
+    str = runestring::format(runestring("{:\xe2\x80\xa6<3}"), rune(0x1f600));
+    assert(str.width() == 4 && str.length() == 3);
+    assert(str == "\xf0\x9f\x98\x80\xe2\x80\xa6\xe2\x80\xa6");
+
+    try
+    {
+      runestring::format(runestring("{"), 1);
+      assert(false);
+    }
+    catch (const std::invalid_argument&) {}
+    try
+    {
+      runestring::format(runestring("}"));
+      assert(false);
+    }
+    catch (const std::invalid_argument&) {}
+    try
+    {
+      runestring::format(runestring("{2}"), 1, 2);
+      assert(false);
+    }
+    catch (const std::out_of_range&) {}
+  }
+
+  {
+    using peelo::operator""_rs;
+    const runestring get = "GET"_rs;
+    const runestring text = "literal which does not fit inline"_rs;
+    runestring copy = text;
+
+    assert(get == "GET" && get == runestring("GET"));
+    assert(get.hash() == runestring("GET").hash());
+    assert(text.length() == 33 && text.is_ascii() && text.max_code() == 'w');
+    assert(text.use_count() == 0 && text.buffer_size() == 0);
+    assert(copy.use_count() == 0 && !copy.resource());
+    assert(text.substr(8, 5) == "which" && text.substr(8).use_count() == 0);
+    assert(text.substr(8, 5).max_code() == 'w');
+    assert(text.trim() == text && text.compact().use_count() == 0);
+    copy += "!";
+    assert(copy.length() == 34 && copy.use_count() == 1);
+    assert(text.length() == 33 && text[32].code() == 'e');
+    copy = text;
+    copy.make_upper();
+    assert(copy == "LITERAL WHICH DOES NOT FIT INLINE");
+    assert(text.to_upper() == copy && text.substr(0, 7) == "literal");
+    assert("\xc3\xa4iti"_rs == "\xc3\xa4iti" && "\xc3\xa4iti"_rs.width() == 1);
+    assert(""_rs.empty());
+
+    const runestring wide = U"\U0001f600 literal with four byte runes"_rs;
+
+    assert(wide.width() == 4 && wide.length() == 30);
+    assert(wide.max_code() == 0x1f600 && wide.use_count() == 0);
+    assert(wide.substr(2, 7) == "literal" && wide.substr(2, 7).is_ascii());
+    assert(wide.utf8() == "\xf0\x9f\x98\x80 literal with four byte runes");
+    try
+    {
+      U"\x110000"_rs;
+      assert(false);
+    }
+    catch (const std::out_of_range&) {}
+  }
+
+  {
+    const runestring wide(
+      "the quick brown fox jumps over the lazy dog\xf0\x9f\x98\x80"
+    );
+    const runestring narrow("the quick brown fox jumps over the lazy dog");
+    std::unordered_set<std::size_t> hashes;
+    std::unordered_map<runestring, int> counts;
+
+    for (runestring::size_type i = 0; i <= narrow.length(); ++i)
+    {
+      const runestring prefix = narrow.substr(0, i);
+
+      assert(wide.substr(0, i).hash() == prefix.hash());
+      assert(std::hash<runestring>()(prefix) == prefix.hash());
+      hashes.insert(prefix.hash());
+    }
+    assert(hashes.size() == narrow.length() + 1);
+    assert(runestring("ab").hash() != runestring("ba").hash());
+    assert(runestring(1, rune(0)).hash() != runestring().hash());
+
+    for (const auto& word : narrow.words())
+    {
+      ++counts[word];
+    }
+    assert(counts.size() == 8);
+    assert(counts[runestring("the")] == 2 && counts[wide.substr(4, 5)] == 1);
+  }
+
   assert(runestring("abc").find("bc") == 1);
   assert(runestring("abcdef").find("de", 3) == 3);
   assert(runestring("abc").find("d") == runestring::npos);
@@ -39,5 +533,19 @@ int main()
   assert(runestring("a").words().size() == 1);
   assert(runestring("\ta  b\t c").words().size() == 3);
 
+  {
+    std::string input;
+
+    for (int i = 0; i < 256 * 1024; ++i)
+    {
+      input += i % 5 ? "a\xc3\xa4" : "\xf0\x9f\x98\x80";
+    }
+    assert(runestring::decode_parallel(input.data(), input.size(), 4)
+           == runestring(input.data(), input.size()));
+    input[input.size() / 2] = '\xff';
+    assert(runestring::decode_parallel(input.data(), input.size(), 7)
+           == runestring(input.data(), input.size()));
+  }
+
   return 0;
 }
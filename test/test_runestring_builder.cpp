@@ -0,0 +1,88 @@
+#include <peelo/text/runestring_builder.hpp>
+#include <cassert>
+#include <climits>
+#include <string>
+
+using peelo::rune;
+using peelo::runestring;
+using peelo::runestring_builder;
+
+int main()
+{
+  {
+    runestring_builder builder;
+
+    assert(builder.empty() && builder.capacity() == 0);
+    assert(builder.str().empty());
+    builder.append(rune('a')).append("bc").append(2, rune('d'));
+    builder << runestring("ef") << std::string("g") << 42 << -7;
+    assert(builder.length() == 12);
+    assert(builder.str() == "abcddefg42-7");
+    assert(builder.empty() && builder.capacity() > 0);
+  }
+
+  {
+    runestring_builder builder(100);
+    runestring str;
+
+    assert(builder.capacity() == 100);
+    for (int i = 0; i < 100; ++i)
+    {
+      builder.append(rune('a' + i % 26));
+    }
+    assert(builder.capacity() == 100);
+    str = builder.str();
+    assert(str.length() == 100 && str.width() == 1);
+    assert(str.substr(26, 3) == "abc");
+    assert(str.buffer_size() == 100 && str.use_count() == 1);
+    assert(builder.capacity() == 0);
+  }
+
+  {
+    runestring_builder builder;
+    runestring str;
+
+    builder << "abcdefghijklmnop";
+    assert(builder.str().width() == 1);
+    builder << "abcdefghijklmnop" << rune(0x20ac);
+    str = builder.str();
+    assert(str.width() == 2);
+    assert(str == "abcdefghijklmnop\xe2\x82\xac");
+    builder << "\xf0\x9f\x98\x80" << runestring("abcdefghijklmnop");
+    builder.append(3, rune(0xe4));
+    str = builder.str();
+    assert(str.width() == 4 && str.length() == 20);
+    assert(str.substr(1, 16) == "abcdefghijklmnop");
+    assert(str.substr(17) == "\xc3\xa4\xc3\xa4\xc3\xa4");
+  }
+
+  {
+    runestring_builder builder;
+
+    builder << rune(0x1f600);
+    builder.clear();
+    assert(builder.empty());
+    builder << "abc";
+    assert(builder.str().width() == 1);
+    builder.append(LLONG_MIN).append(' ').append(ULLONG_MAX);
+    assert(builder.str() == "-9223372036854775808 18446744073709551615");
+    builder.append(0u).append(0L).append(12UL);
+    assert(builder.str() == "0012");
+  }
+
+  {
+    runestring_builder builder;
+    runestring_builder moved;
+    const char* invalid = "ab\xff" "cd";
+
+    builder.reserve(10);
+    builder << "foo";
+    moved = std::move(builder);
+    assert(builder.empty() && builder.capacity() == 0);
+    assert(moved.str() == "foo");
+    moved.append(invalid);
+    assert(moved.str() == "ab");
+  }
+
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include <peelo/text/runestring_intern_pool.hpp>
+#include <cassert>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using peelo::runestring;
+using peelo::runestring_intern_pool;
+
+int main()
+{
+  {
+    runestring_intern_pool pool;
+    const std::string key("a key which is too long to be stored inline");
+    const runestring a = pool.intern(key);
+    const runestring b = pool.intern(runestring(key.c_str()));
+    const runestring c = pool.intern(key.c_str(), key.length());
+
+    assert(a == key.c_str() && a.use_count() == 4);
+    assert(b.use_count() == 4 && c.use_count() == 4);
+    assert(pool.size() == 1);
+    assert(pool.symbol(key) == pool.symbol(a));
+    assert(pool.str(pool.symbol(key)) == a);
+    assert(pool.symbol("other") != pool.symbol(key));
+    assert(pool.size() == 2);
+
+    // Strings are keyed by their UTF-8 encoding regardless of width.
+    assert(pool.symbol("\xc3\xa4iti") ==
+           pool.symbol(runestring("\xc3\xa4iti")));
+    assert(pool.intern("\xf0\x9f\x98\x80").width() == 4);
+    assert(pool.size() == 4);
+
+    // Input after an invalid sequence is not part of the string.
+    assert(pool.symbol("ab\xff" "cd") == pool.symbol("ab"));
+    assert(pool.intern("ab\xff" "cd") == "ab");
+    assert(pool.symbol("") == pool.symbol(runestring()));
+
+    // Overlong sequences map to the same entry as the shortest form.
+    const runestring_intern_pool::size_type size = pool.size();
+    const runestring_intern_pool::symbol_type overlong = pool.symbol(
+      "\xc1\x81"
+    );
+
+    assert(overlong == pool.symbol("A") && pool.symbol("A") == overlong);
+    assert(pool.symbol("\xe0\x81\x81") == overlong);
+    assert(pool.str(overlong) == "A" && pool.size() == size + 1);
+
+    // Runes which cannot be encoded with UTF-8 do not collide with others.
+    const runestring surrogate("x\xed\xa0\x80");
+
+    assert(surrogate.length() == 2);
+    assert(pool.symbol(surrogate) != pool.symbol("x"));
+    assert(pool.symbol("x\xed\xa0\x80") == pool.symbol(surrogate));
+    assert(pool.intern(surrogate)[1].code() == 0xd800);
+    assert(pool.symbol("\xff\x78") == pool.symbol(""));
+
+    // Substrings do not keep their parent alive in the pool.
+    const runestring parent(
+      "prefix which keeps rest of the buffer alive and suffix"
+    );
+    const runestring sub = pool.intern(parent.substr(0, 40));
+
+    assert(sub.buffer_size() == 40 && parent.use_count() == 1);
+
+    // Strings interned within a request scoped resource outlive it.
+    {
+      peelo::monotonic_buffer_resource arena;
+      const peelo::memory_resource_scope scope(&arena);
+      const std::string scoped("a key which is interned within an arena");
+
+      pool.intern(scoped);
+      pool.intern(runestring(scoped.c_str()) + "!");
+      arena.release();
+    }
+    assert(pool.intern("a key which is interned within an arena").resource() ==
+           peelo::new_delete_resource());
+    assert(pool.intern("a key which is interned within an arena!").use_count()
+           == 2);
+
+    try
+    {
+      pool.str(12345);
+      assert(false);
+    }
+    catch (const std::out_of_range&) {}
+  }
+
+  {
+    runestring_intern_pool pool(4);
+    std::vector<std::thread> workers;
+    std::vector<std::vector<runestring_intern_pool::symbol_type>> symbols(4);
+
+    for (std::size_t i = 0; i < symbols.size(); ++i)
+    {
+      workers.push_back(std::thread([&pool, &symbols, i]()
+      {
+        for (int j = 0; j < 2000; ++j)
+        {
+          symbols[i].push_back(pool.symbol("key " + std::to_string(j % 500)));
+        }
+      }));
+    }
+    for (auto& worker : workers)
+    {
+      worker.join();
+    }
+    assert(pool.size() == 500);
+    for (std::size_t i = 1; i < symbols.size(); ++i)
+    {
+      assert(symbols[i] == symbols[0]);
+    }
+    assert(pool.str(symbols[0][7]) == "key 7");
+  }
+
+  return 0;
+}
@@ -0,0 +1,87 @@
+#include <cassert>
+#include <peelo/text/utf8_runestring.hpp>
+
+using peelo::rune;
+using peelo::runestring;
+using peelo::utf8_runestring;
+
+int main()
+{
+  std::string input;
+
+  assert(utf8_runestring().empty());
+  assert(utf8_runestring("").length() == 0);
+  assert(utf8_runestring("abc").length() == 3);
+  assert(utf8_runestring("a\xc3\xa4\xf0\x9f\x98\x80").length() == 3);
+  assert(utf8_runestring("ab\xff" "cd").length() == 2);
+  assert(utf8_runestring("ab\xff" "cd").size() == 2);
+  assert(utf8_runestring("a\xc3\xa4o")[1] == rune(0xe4));
+  assert(utf8_runestring("a\xc3\xa4o").back() == rune('o'));
+  assert(utf8_runestring("a\xc3\xa4o").runes() == runestring("a\xc3\xa4o"));
+  assert(utf8_runestring(runestring("\xc3\xa4")).utf8() == "\xc3\xa4");
+
+  for (int i = 0; i < 1000; ++i)
+  {
+    input += i % 3 ? "a" : i % 2 ? "\xc3\xa4" : "\xe2\x82\xac";
+  }
+  input += "needle";
+  {
+    const utf8_runestring str(input);
+    const runestring runes(input.c_str());
+    const char* bytes = str.data();
+    utf8_runestring::size_type i = 0;
+
+    assert(str.length() == runes.length());
+    for (utf8_runestring::size_type j = 0; j < runes.length(); j += 37)
+    {
+      assert(str[j] == runes[j]);
+    }
+    for (auto c : str)
+    {
+      assert(c == runes[i++]);
+    }
+    assert(i == runes.length());
+    assert(str.substr(500, 10).runes() == runes.substr(500, 10));
+    assert(str.substr(500).substr(100, 10).runes() == runes.substr(600, 10));
+    assert(str.substr(130, 70).length() == 70);
+    assert(str.substr(130, 70).data() == bytes + str.substr(0, 130).size());
+    assert(str.find("needle") == 1000);
+    assert(str.find(rune(0x20ac)) == 0);
+    assert(str.find(rune(0x20ac), 1) == 6);
+    assert(str.substr(1).find(rune(0x20ac)) == 5);
+    assert(str.rfind(rune(0x20ac)) == 996);
+    assert(str.rfind("a", 998) == 998);
+    assert(str.find("x") == utf8_runestring::npos);
+    assert(str.utf8() == input);
+  }
+
+  assert(utf8_runestring("abc") == utf8_runestring("abc"));
+  assert(utf8_runestring("abc") < utf8_runestring("abd"));
+  assert(utf8_runestring("\xc3\xa4") > utf8_runestring("z"));
+  assert(utf8_runestring("ab") < utf8_runestring("abc"));
+  assert(utf8_runestring("\xc3\x84" "B").equals_icase("\xc3\xa4" "b"));
+  assert(utf8_runestring("ab").compare_icase("ABC") < 0);
+
+  // Overlong sequences compare and search by their runes.
+  assert(utf8_runestring("\xc1\x81", 2).length() == 1);
+  assert(utf8_runestring("\xc1\x81", 2) == utf8_runestring("A"));
+  assert(utf8_runestring("A") == utf8_runestring("\xe0\x81\x81", 3));
+  assert(utf8_runestring("\xc1\x81", 2).compare("A") == 0);
+  assert(utf8_runestring("\xc1\x81", 2) < utf8_runestring("B"));
+  assert(utf8_runestring("\xc1\x81" "B", 3) > utf8_runestring("A"));
+  assert(utf8_runestring("x\xc1\x81y").find("A") == 1);
+  assert(utf8_runestring("x\xc1\x81y").find(rune('A')) == 1);
+  assert(utf8_runestring("xAy").find("\xc1\x81y") == 1);
+  assert(utf8_runestring("A\xc1\x81y").rfind("A") == 1);
+  assert(utf8_runestring("A\xc1\x81y").rfind("A", 0) == 0);
+  assert(utf8_runestring("x\xc1\x81y").find("Ay", 2) == utf8_runestring::npos);
+
+  // Surrogates are decoded, even though they cannot be encoded.
+  assert(utf8_runestring("x\xed\xa0\x80y").find(rune(0xd800)) == 1);
+  assert(utf8_runestring("\xed\xa0\x80y\xed\xa0\x80").rfind(rune(0xd800))
+         == 2);
+  assert(utf8_runestring("\xed\xa0\x80y").rfind(rune(0xd800), 1) == 0);
+  assert(utf8_runestring("xy").find(rune(0xd800)) == utf8_runestring::npos);
+
+  return 0;
+}